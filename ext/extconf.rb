@@ -38,6 +38,9 @@ SI_TAXI_DIR = File.expand_path(File.join(File.dirname(__FILE__),'si_taxi'))
 Config::CONFIG['CPP'] = 'g++ -E'
 $LIBS += " -lstdc++"
 
+# the sampling and voting handler can generate its samples in threads
+$LIBS += " -lboost_thread"
+
 # need gcov for a coverage build
 $LIBS += " -lgcov" if target == 'Coverage'
 
@@ -6,10 +6,12 @@
 #include <si_taxi/natural_histogram.h>
 #include <si_taxi/od_histogram.h>
 #include <si_taxi/od_matrix_wrapper.h>
+#include <si_taxi/min_cost_flow.h>
 #include <si_taxi/bell_wong/bell_wong.h>
 #include <si_taxi/bell_wong/call_times.h>
 #include <si_taxi/bell_wong/andreasson.h>
 #include <si_taxi/bell_wong/dynamic_tp.h>
+#include <si_taxi/bell_wong/approximate_tp.h>
 #include <si_taxi/bell_wong/sampling_voting.h>
 #include <si_taxi/bell_wong/surplus_deficit.h>
 #include <si_taxi/mdp_sim/mdp_sim.h>
@@ -86,12 +88,15 @@ void seed_rng(unsigned int seed) {
 %clear size_t &destin;
 %clear double &interval;
 
+%include "si_taxi/min_cost_flow.h"
+
 %feature("director") BWProactiveHandler;
 
 %include "si_taxi/bell_wong/bell_wong.h"
 %include "si_taxi/bell_wong/call_times.h"
 %include "si_taxi/bell_wong/andreasson.h"
 %include "si_taxi/bell_wong/dynamic_tp.h"
+%include "si_taxi/bell_wong/approximate_tp.h"
 %include "si_taxi/bell_wong/sampling_voting.h"
 %include "si_taxi/bell_wong/surplus_deficit.h"
 
@@ -81,6 +81,10 @@ void BWAndreassonHandler::handle_idle(BWVehicle &veh) {
   }
 }
 
+void BWAndreassonHandler::handle_coalesced_events() {
+  FAIL("BWAndreassonHandler does not support coalesced events");
+}
+
 int BWAndreassonHandler::supply_at(size_t i) const {
   ASSERT(i < sim.num_stations());
   if (immediate_inbound_only && use_call_times_for_inbound) {
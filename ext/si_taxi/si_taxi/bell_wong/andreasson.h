@@ -33,6 +33,13 @@ struct BWAndreassonHandler : public BWProactiveHandler {
    */
   virtual void handle_idle(BWVehicle &veh);
 
+  /**
+   * Override. This handler responds to individual passengers and idle
+   * vehicles, so it cannot be used in a sim that coalesces events (see
+   * BWSim::coalesce_events); this throws.
+   */
+  virtual void handle_coalesced_events();
+
   /**
    * Compute supply at station i; see surplus for details.
    */
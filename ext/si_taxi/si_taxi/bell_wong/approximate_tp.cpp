@@ -0,0 +1,272 @@
+#include <si_taxi/stdafx.h>
+#include <si_taxi/utility.h>
+#include <si_taxi/min_cost_flow.h>
+#include "approximate_tp.h"
+#include "dynamic_tp.h"
+
+using namespace std;
+
+namespace si_taxi {
+
+BWApproximateTransportationProblemHandler::
+  BWApproximateTransportationProblemHandler(BWSim &sim,
+      BWApproximateTPMethod method) : BWProactiveHandler(sim),
+    gap_sample_interval(0), num_problems(0), num_gap_samples(0),
+    sampled_approximate_cost(0), sampled_exact_cost(0), _method(method) {
+  targets.resize(sim.num_stations(), 0);
+  surpluses.resize(sim.num_stations());
+  idle.resize(sim.num_stations());
+}
+
+void BWApproximateTransportationProblemHandler::handle_pax_served(
+    size_t /*empty_origin*/) {
+  redistribute();
+}
+
+void BWApproximateTransportationProblemHandler::handle_idle(
+    BWVehicle &/*veh*/) {
+  redistribute();
+}
+
+void BWApproximateTransportationProblemHandler::handle_strobe() {
+  redistribute();
+}
+
+void BWApproximateTransportationProblemHandler::redistribute() {
+  ASSERT(targets.size() == sim.num_stations());
+  count_redistribution_surpluses(sim, targets, &surpluses[0], &idle[0]);
+
+  origins.clear();
+  supply.clear();
+  destins.clear();
+  demand.clear();
+  for (size_t i = 0; i < sim.num_stations(); ++i) {
+    if (surpluses[i] > 0) {
+      origins.push_back(i);
+      supply.push_back(surpluses[i]);
+    } else if (surpluses[i] < 0) {
+      destins.push_back(i);
+      demand.push_back(-surpluses[i]);
+    }
+  }
+  if (origins.empty() || destins.empty())
+    return;
+  ++num_problems;
+
+  costs.resize(origins.size() * destins.size());
+  for (size_t o = 0; o < origins.size(); ++o) {
+    for (size_t d = 0; d < destins.size(); ++d) {
+      costs[o * destins.size() + d] = sim.trip_time(origins[o], destins[d]);
+    }
+  }
+
+  // The matching uses up the supplies and demands, so solve exactly first.
+  bool sample = gap_sample_interval > 0 &&
+      num_problems % gap_sample_interval == 0;
+  double exact = sample ? exact_cost() : 0;
+
+  moves.clear();
+  switch (_method) {
+  case BW_APPROXIMATE_TP_GREEDY:
+    match_greedy();
+    break;
+  case BW_APPROXIMATE_TP_REGRET:
+    match_regret();
+    break;
+  default:
+    FAIL("unknown method: " << _method);
+  }
+
+  if (sample) {
+    ++num_gap_samples;
+    sampled_approximate_cost += moves_cost();
+    sampled_exact_cost += exact;
+  }
+
+  for (size_t m = 0; m < moves.size(); ++m) {
+    for (int n = 0; n < moves[m].count; ++n) {
+      ASSERT(sim.num_vehicles_idle_by(moves[m].origin, sim.now) > 0);
+      sim.move_empty_od(moves[m].origin, moves[m].destin);
+    }
+  }
+}
+
+double BWApproximateTransportationProblemHandler::gap() const {
+  if (sampled_exact_cost > 0)
+    return sampled_approximate_cost / sampled_exact_cost - 1;
+  return 0;
+}
+
+void BWApproximateTransportationProblemHandler::match_greedy() {
+  size_t num_destins = destins.size();
+  vector<pair<int, size_t> > order(costs.size());
+  for (size_t k = 0; k < costs.size(); ++k) {
+    order[k] = make_pair(costs[k], k);
+  }
+  sort(order.begin(), order.end());
+
+  int total_supply = accumulate(supply.begin(), supply.end(), 0);
+  int total_demand = accumulate(demand.begin(), demand.end(), 0);
+  int unmatched = min(total_supply, total_demand);
+  for (size_t k = 0; k < order.size() && unmatched > 0; ++k) {
+    size_t o = order[k].second / num_destins;
+    size_t d = order[k].second % num_destins;
+    if (supply[o] > 0 && demand[d] > 0) {
+      unmatched -= min(supply[o], demand[d]);
+      add_move(o, d);
+    }
+  }
+}
+
+void BWApproximateTransportationProblemHandler::match_regret() {
+  // The rows are the side with the smaller total, which can all be matched.
+  int total_supply = accumulate(supply.begin(), supply.end(), 0);
+  int total_demand = accumulate(demand.begin(), demand.end(), 0);
+  bool rows_are_origins = total_supply <= total_demand;
+  vector<int> &row_amount = rows_are_origins ? supply : demand;
+  vector<int> &col_amount = rows_are_origins ? demand : supply;
+  size_t num_rows = row_amount.size();
+  size_t num_cols = col_amount.size();
+  size_t num_destins = destins.size();
+
+  // Columns for each row in ascending order by cost, and the first one for
+  // each row that may still have some amount left.
+  vector<size_t> ranked(num_rows * num_cols);
+  vector<size_t> first(num_rows, 0);
+  vector<pair<int, size_t> > row_costs(num_cols);
+  for (size_t r = 0; r < num_rows; ++r) {
+    for (size_t c = 0; c < num_cols; ++c) {
+      row_costs[c] = make_pair(rows_are_origins ?
+          costs[r * num_destins + c] : costs[c * num_destins + r], c);
+    }
+    sort(row_costs.begin(), row_costs.end());
+    for (size_t c = 0; c < num_cols; ++c) {
+      ranked[r * num_cols + c] = row_costs[c].second;
+    }
+  }
+
+  for (;;) {
+    size_t best_row = SIZE_T_MAX;
+    size_t best_col = SIZE_T_MAX;
+    int best_regret = -1;
+    for (size_t r = 0; r < num_rows; ++r) {
+      if (row_amount[r] == 0)
+        continue;
+
+      const size_t *row_ranked = &ranked[r * num_cols];
+      while (col_amount[row_ranked[first[r]]] == 0) {
+        ++first[r];
+        ASSERT(first[r] < num_cols);
+      }
+      size_t second = first[r] + 1;
+      while (second < num_cols && col_amount[row_ranked[second]] == 0) {
+        ++second;
+      }
+
+      size_t c1 = row_ranked[first[r]];
+      int regret;
+      if (second < num_cols) {
+        size_t c2 = row_ranked[second];
+        regret = rows_are_origins ?
+            costs[r * num_destins + c2] - costs[r * num_destins + c1] :
+            costs[c2 * num_destins + r] - costs[c1 * num_destins + r];
+      } else {
+        regret = numeric_limits<int>::max();
+      }
+      if (regret > best_regret) {
+        best_regret = regret;
+        best_row = r;
+        best_col = c1;
+      }
+    }
+    if (best_row == SIZE_T_MAX)
+      break;
+
+    if (rows_are_origins)
+      add_move(best_row, best_col);
+    else
+      add_move(best_col, best_row);
+  }
+}
+
+void BWApproximateTransportationProblemHandler::add_move(size_t o, size_t d) {
+  Move move;
+  move.origin = origins[o];
+  move.destin = destins[d];
+  move.count = min(supply[o], demand[d]);
+  ASSERT(move.count > 0);
+  moves.push_back(move);
+  supply[o] -= move.count;
+  demand[d] -= move.count;
+}
+
+double BWApproximateTransportationProblemHandler::moves_cost() const {
+  double cost = 0;
+  for (size_t m = 0; m < moves.size(); ++m) {
+    cost += (double)moves[m].count *
+        sim.trip_time(moves[m].origin, moves[m].destin);
+  }
+  return cost;
+}
+
+double BWApproximateTransportationProblemHandler::exact_cost() {
+  // A transportation problem from the origins to the destins, with a source
+  // and sink to take up the difference between total supply and demand, as
+  // in the DTP handler.
+  int num_origins = origins.size();
+  int num_destins = destins.size();
+  int num_nodes = num_origins + num_destins + 2;
+  int num_arcs = num_origins * num_destins + num_origins + num_destins;
+  int source = num_origins + num_destins + 1;
+  int sink = num_origins + num_destins + 2;
+  int total_supply = accumulate(supply.begin(), supply.end(), 0);
+  int total_demand = accumulate(demand.begin(), demand.end(), 0);
+
+  vector<int> start_nodes(num_arcs), end_nodes(num_arcs);
+  vector<int> arc_costs(num_arcs), capacities(num_arcs, total_supply +
+      total_demand), flows(num_arcs), node_demands(num_nodes);
+  int a = 0;
+  for (int o = 0; o < num_origins; ++o) {
+    for (int d = 0; d < num_destins; ++d) {
+      start_nodes[a] = o + 1;
+      end_nodes[a] = num_origins + d + 1;
+      arc_costs[a] = costs[o * num_destins + d];
+      ++a;
+    }
+  }
+  for (int o = 0; o < num_origins; ++o) {
+    start_nodes[a] = o + 1;
+    end_nodes[a] = sink;
+    arc_costs[a] = 0;
+    ++a;
+  }
+  for (int d = 0; d < num_destins; ++d) {
+    start_nodes[a] = source;
+    end_nodes[a] = num_origins + d + 1;
+    arc_costs[a] = 0;
+    ++a;
+  }
+  CHECK(a == num_arcs);
+
+  for (int o = 0; o < num_origins; ++o) {
+    node_demands[o] = -supply[o];
+  }
+  for (int d = 0; d < num_destins; ++d) {
+    node_demands[num_origins + d] = demand[d];
+  }
+  node_demands[source - 1] = -max(0, total_demand - total_supply);
+  node_demands[sink - 1] = max(0, total_supply - total_demand);
+
+  Relax4Solver solver;
+  solver.init(num_nodes, num_arcs, &start_nodes[0], &end_nodes[0],
+      &arc_costs[0], &capacities[0], &node_demands[0], &flows[0]);
+  CHECK(solver.solve());
+
+  double cost = 0;
+  for (a = 0; a < num_origins * num_destins; ++a) {
+    cost += (double)flows[a] * arc_costs[a];
+  }
+  return cost;
+}
+
+}
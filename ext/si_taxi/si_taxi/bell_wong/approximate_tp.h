@@ -0,0 +1,141 @@
+#ifndef SI_TAXI_BELL_WONG_APPROXIMATE_TP_H_
+#define SI_TAXI_BELL_WONG_APPROXIMATE_TP_H_
+
+#include "bell_wong.h"
+
+namespace si_taxi {
+
+/**
+ * Heuristics for matching surpluses to deficits in
+ * BWApproximateTransportationProblemHandler.
+ */
+enum BWApproximateTPMethod {
+  /**
+   * Match the closest surplus and deficit stations first; O(SD log SD) for S
+   * surplus and D deficit stations.
+   */
+  BW_APPROXIMATE_TP_GREEDY,
+  /**
+   * Vogel-style regret: the stations on the smaller side (which can all be
+   * matched) are matched in descending order by the difference in cost between
+   * their best and second best remaining partners.
+   */
+  BW_APPROXIMATE_TP_REGRET
+};
+
+/**
+ * An approximate version of the Dynamic Transportation Problem (DTP)
+ * heuristic (see BWDynamicTransportationProblemHandler) for very large
+ * networks and fleets. The surpluses and deficits are computed in the same
+ * way, but they are matched with a heuristic instead of solving the
+ * transportation problem exactly, and vehicles are moved directly from
+ * surplus stations to deficit stations.
+ *
+ * To see how much this costs, set gap_sample_interval; the exact problem is
+ * then also solved on every gap_sample_interval'th redistribution, and the
+ * empty vehicle travel times for the two solutions are accumulated in
+ * sampled_approximate_cost and sampled_exact_cost.
+ */
+struct BWApproximateTransportationProblemHandler : public BWProactiveHandler {
+  /**
+   * @param sim
+   * @param method see BWApproximateTPMethod
+   */
+  BWApproximateTransportationProblemHandler(BWSim &sim,
+      BWApproximateTPMethod method = BW_APPROXIMATE_TP_GREEDY);
+
+  /**
+   * Override.
+   */
+  virtual void handle_pax_served(size_t empty_origin);
+
+  /**
+   * Override.
+   */
+  virtual void handle_idle(BWVehicle &veh);
+
+  /**
+   * Override.
+   */
+  virtual void handle_strobe();
+
+  /**
+   * Compute surpluses and deficits, match them, and move vehicles.
+   */
+  void redistribute();
+
+  /// See constructor.
+  inline BWApproximateTPMethod matching_method() const { return _method; }
+
+  /**
+   * Relative gap between the approximate and exact solutions on the sampled
+   * problems; zero if no problems have been sampled.
+   */
+  double gap() const;
+
+  /// see redistribute(...); the same as for the DTP handler
+  std::vector<int> targets;
+
+  /**
+   * If non-zero, solve every gap_sample_interval'th problem exactly too, to
+   * measure the gap; default 0 (never).
+   */
+  size_t gap_sample_interval;
+
+  /// number of redistributions that had at least one surplus and deficit
+  size_t num_problems;
+
+  /// number of problems that were also solved exactly
+  size_t num_gap_samples;
+
+  /// total cost (empty vehicle travel time) of the approximate solutions for
+  /// the sampled problems
+  double sampled_approximate_cost;
+
+  /// total cost of the exact solutions for the sampled problems
+  double sampled_exact_cost;
+
+protected:
+  /// a number of vehicles to move from one station to another
+  struct Move {
+    size_t origin;
+    size_t destin;
+    int count;
+  };
+
+  /// Fill moves using the greedy method; see BWApproximateTPMethod.
+  void match_greedy();
+
+  /// Fill moves using the regret method; see BWApproximateTPMethod.
+  void match_regret();
+
+  /// Add a move and reduce the corresponding supply and demand.
+  void add_move(size_t o, size_t d);
+
+  /// Total cost of moves.
+  double moves_cost() const;
+
+  /// Solve the current problem exactly and return its cost.
+  double exact_cost();
+
+  BWApproximateTPMethod _method;
+
+  /// see count_redistribution_surpluses
+  std::vector<int> surpluses;
+  /// temporary storage for count_redistribution_surpluses
+  std::vector<int> idle;
+  /// stations with surpluses, and the surplus at each
+  std::vector<size_t> origins;
+  std::vector<int> supply;
+  /// stations with deficits, and the deficit at each
+  std::vector<size_t> destins;
+  std::vector<int> demand;
+  /// trip times from origins to destins; origins.size() by destins.size()
+  std::vector<int> costs;
+  /// the matching, from match_greedy or match_regret
+  std::vector<Move> moves;
+};
+
+}
+
+#endif // guard
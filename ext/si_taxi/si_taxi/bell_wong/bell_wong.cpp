@@ -1,30 +1,82 @@
 #include "bell_wong.h"
+#include "bell_wong_t.h"
+#include "vehicle_kernels.h"
 #include <si_taxi/stdafx.h>
 #include <si_taxi/utility.h>
+#include <typeinfo>
 
 using namespace std;
 
 namespace si_taxi {
 
+void BWVehicleArrays::resize(size_t num_veh) {
+  origin.resize(num_veh);
+  destin.resize(num_veh);
+  arrive.resize(num_veh);
+}
+
+void BWVehicleArrays::set(size_t k, const BWVehicle &veh) {
+  ASSERT(k < size());
+  CHECK(veh.origin <= (size_t)numeric_limits<int>::max());
+  CHECK(veh.destin <= (size_t)numeric_limits<int>::max());
+  CHECK(numeric_limits<int>::min() <= veh.arrive &&
+      veh.arrive <= numeric_limits<int>::max());
+  origin[k] = (int)veh.origin;
+  destin[k] = (int)veh.destin;
+  arrive[k] = (int)veh.arrive;
+}
+
+BWVehicle BWVehicleArrays::get(size_t k) const {
+  ASSERT(k < size());
+  return BWVehicle(origin[k], destin[k], arrive[k]);
+}
+
 void BWSim::init() {
   ASSERT(this->reactive);
   ASSERT(this->proactive);
   ASSERT(this->stats);
+  check_station_index_range(num_stations());
 
   now = 0;
+  _events_pending = false;
+  _calendar_vehs = SIZE_T_MAX;
+  _index_valid = false;
   this->reactive->init();
   this->proactive->init();
   this->stats->init();
 }
 
 void BWSim::add_vehicles_in_turn(size_t num_veh, size_t station) {
-  if (num_veh > 0) {
-    station = station % num_stations();
+  if (num_veh == 0)
+    return;
+  CHECK(num_stations() > 0);
+  station = station % num_stations();
+  vehs.reserve(vehs.size() + num_veh);
+  for (; num_veh > 0; --num_veh) {
     vehs.push_back(BWVehicle(station, now));
-    add_vehicles_in_turn(num_veh - 1, station + 1);
+    station = (station + 1) % num_stations();
   }
 }
 
+void BWSim::add_vehicles_at(const std::vector<int> &counts) {
+  CHECK(counts.size() == num_stations());
+  size_t num_veh = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    CHECK(counts[i] >= 0);
+    num_veh += counts[i];
+  }
+  vehs.reserve(vehs.size() + num_veh);
+  for (size_t i = 0; i < counts.size(); ++i) {
+    vehs.insert(vehs.end(), counts[i], BWVehicle(i, now));
+  }
+}
+
+void BWSim::add_vehicles_in_proportion(size_t num_veh,
+    const std::vector<double> &weights) {
+  CHECK(weights.size() == num_stations());
+  add_vehicles_at(apportion(num_veh, weights));
+}
+
 void BWSim::park_vehicles_in_turn(size_t station) {
   CHECK(station < num_stations());
   for (size_t k = 0; k < vehs.size(); ++k) {
@@ -32,54 +84,28 @@ void BWSim::park_vehicles_in_turn(size_t station) {
     vehs[k].arrive = now;
     station = (station + 1) % num_stations();
   }
+  _calendar_vehs = SIZE_T_MAX;
+  _index_valid = false;
 }
 
 void BWSim::run_to(BWTime t) {
-  ASSERT(this->reactive);
-  ASSERT(this->proactive);
-  ASSERT(this->stats);
-  ASSERT(t >= now);
-
-  for (; now < t; ++now) {
-    // record queue lengths and vehicle states
-    stats->record_time_step_stats();
-
-    // Catch up on vehicle idle events.
-    for (size_t k = 0; k < vehs.size(); ++k) {
-      if (vehs[k].arrive == now) {
-        proactive->handle_idle(vehs[k]);
-      }
-    }
-
-    // Catch up on strobe events if strobe is enabled.
-    if (strobe > 0 && now % strobe == 0) {
-      proactive->handle_strobe();
-    }
-  }
+  BWSimVirtualDispatch d(*this);
+  run_to_with(t, d);
 }
 
 void BWSim::handle_pax(const BWPax & pax) {
-  //TV(this->now);
-  ASSERT(pax.origin < num_stations());
-  ASSERT(pax.destin < num_stations());
-
-  // Run the sim up to just before the passenger's arrival...
-  this->run_to(pax.arrive);
+  BWSimVirtualDispatch d(*this);
+  handle_pax_with(pax, d);
+}
 
-  // then handle the new arrival.
-  size_t k = reactive->handle_pax(pax);
-  if (k != numeric_limits<size_t>::max()) {
-    size_t empty_origin = vehs.at(k).destin;
-    serve_pax(k, pax);
-    proactive->handle_pax_served(empty_origin);
-  }
+void BWSim::handle_pax_batch(const BWPax *pax, size_t num_pax) {
+  BWSimVirtualDispatch d(*this);
+  handle_pax_batch_with(pax, num_pax, d);
 }
 
 void BWSim::handle_pax_stream(size_t num_pax, BWPaxStream *pax_stream) {
-  ASSERT(pax_stream);
-  for (; num_pax > 0; --num_pax) {
-    handle_pax(pax_stream->next_pax());
-  }
+  BWSimVirtualDispatch d(*this);
+  handle_pax_stream_with(num_pax, pax_stream, d);
 }
 
 void BWSim::move_empty(size_t k, size_t destin) {
@@ -94,6 +120,7 @@ void BWSim::move_empty(size_t k, size_t destin) {
   veh.origin = veh.destin;
   veh.destin = destin;
   veh.arrive = max(veh.arrive, now) + trip_time(veh.origin, veh.destin);
+  veh_changed(k);
 }
 
 size_t BWSim::move_empty_od(size_t origin, size_t destin) {
@@ -116,13 +143,152 @@ void BWSim::serve_pax(size_t k, const BWPax &pax) {
   BWTime pickup = max(veh.arrive, now) + trip_time(veh.destin, pax.origin);
   stats->record_pax_served(pax, veh.destin, pickup);
 
-  veh.arrive = pickup + trip_time(pax.origin, pax.destin);
-  veh.origin = pax.origin;
-  veh.destin = pax.destin;
+  veh = veh_after_serving(veh, pax);
+  veh_changed(k);
+}
+
+BWVehicle BWSim::veh_after_serving(const BWVehicle &veh, const BWPax &pax)
+const {
+  BWTime pickup = max(veh.arrive, now) + trip_time(veh.destin, pax.origin);
+  return BWVehicle(pax.origin, pax.destin,
+      pickup + trip_time(pax.origin, pax.destin));
+}
+
+void BWSim::veh_changed(size_t k) {
+  ASSERT(k < vehs.size());
+  if (!event_driven) {
+    // calendar is not being maintained; rebuild it if it is needed later
+    _calendar_vehs = SIZE_T_MAX;
+  } else if (_calendar_vehs == vehs.size()) {
+    // any old entry for k is now stale; it is discarded when it is popped
+    _calendar.push(make_pair(vehs[k].arrive, k));
+  }
+
+  if (!indexed) {
+    _index_valid = false;
+  } else if (_index_valid && _veh_arrays.size() == vehs.size()) {
+    update_index();
+    unindex_veh(k);
+    index_veh(k);
+  }
+}
+
+void BWSim::build_calendar() {
+  std::vector<std::pair<BWTime, size_t> > entries;
+  entries.reserve(vehs.size());
+  for (size_t k = 0; k < vehs.size(); ++k) {
+    if (vehs[k].arrive >= now) {
+      entries.push_back(make_pair(vehs[k].arrive, k));
+    }
+  }
+  _calendar = calendar_t(std::greater<std::pair<BWTime, size_t> >(), entries);
+  _calendar_vehs = vehs.size();
+}
+
+BWTime BWSim::next_event_time(BWTime t) {
+  // Coalesced events from passengers that arrived at now are due now.
+  if (_events_pending) {
+    return now;
+  }
+
+  // Discard past and stale entries.
+  while (!_calendar.empty()) {
+    const std::pair<BWTime, size_t> &entry = _calendar.top();
+    if (entry.first >= now && vehs[entry.second].arrive == entry.first) {
+      break;
+    }
+    _calendar.pop();
+  }
+
+  BWTime next = t;
+  if (!_calendar.empty() && _calendar.top().first < next) {
+    next = _calendar.top().first;
+  }
+  if (strobe > 0) {
+    // first multiple of strobe at or after now (now is non-negative)
+    next = min(next, strobe * ((now + strobe - 1) / strobe));
+  }
+  return next;
+}
+
+void BWSim::update_index() const {
+  if (!_index_valid || _veh_arrays.size() != vehs.size() ||
+      _inbound.size() != num_stations() || now < _index_now) {
+    build_index();
+    return;
+  }
+
+  // Vehicles that have arrived by now become idle.
+  while (!_arrivals.empty() && _arrivals.begin()->first <= now) {
+    size_t k = _arrivals.begin()->second;
+    _idle[_veh_arrays.destin[k]].insert(k);
+    _arrivals.erase(_arrivals.begin());
+  }
+
+  // Vehicles that have started their last leg by now are immediately inbound.
+  while (!_departures.empty() && _departures.begin()->first <= now) {
+    --_departing[_veh_arrays.destin[_departures.begin()->second]];
+    _departures.erase(_departures.begin());
+  }
+
+  _index_now = now;
+}
+
+void BWSim::build_index() const {
+  _index_now = now;
+  _veh_arrays.resize(vehs.size());
+  _inbound.assign(num_stations(), 0);
+  _departing.assign(num_stations(), 0);
+  _idle.assign(num_stations(), std::set<size_t>());
+  _by_arrival.assign(num_stations(), time_index_t());
+  _arrivals.clear();
+  _departures.clear();
+  for (size_t k = 0; k < vehs.size(); ++k) {
+    index_veh(k);
+  }
+  _index_valid = true;
+}
+
+void BWSim::index_veh(size_t k) const {
+  const BWVehicle &veh = vehs[k];
+  ASSERT(veh.destin < num_stations());
+  _veh_arrays.set(k, veh);
+  ++_inbound[veh.destin];
+  _by_arrival[veh.destin].insert(make_pair(veh.arrive, k));
+  if (veh.arrive <= _index_now) {
+    _idle[veh.destin].insert(k);
+  } else {
+    _arrivals.insert(make_pair(veh.arrive, k));
+  }
+  BWTime depart = veh.arrive - trip_time(veh.origin, veh.destin);
+  if (depart > _index_now) {
+    ++_departing[veh.destin];
+    _departures.insert(make_pair(depart, k));
+  }
+}
+
+void BWSim::unindex_veh(size_t k) const {
+  BWVehicle veh = _veh_arrays.get(k);
+  --_inbound[veh.destin];
+  _by_arrival[veh.destin].erase(make_pair(veh.arrive, k));
+  if (veh.arrive <= _index_now) {
+    _idle[veh.destin].erase(k);
+  } else {
+    _arrivals.erase(make_pair(veh.arrive, k));
+  }
+  BWTime depart = veh.arrive - trip_time(veh.origin, veh.destin);
+  if (depart > _index_now) {
+    --_departing[veh.destin];
+    _departures.erase(make_pair(depart, k));
+  }
 }
 
 int BWSim::num_vehicles_inbound(size_t i) const {
   ASSERT(i < num_stations());
+  if (indexed) {
+    update_index();
+    return _inbound[i];
+  }
   int count = 0;
   for (size_t k = 0; k < vehs.size(); ++k) {
     if (vehs[k].destin == i) {
@@ -134,6 +300,10 @@ int BWSim::num_vehicles_inbound(size_t i) const {
 
 int BWSim::num_vehicles_immediately_inbound(size_t i) const {
   ASSERT(i < num_stations());
+  if (indexed) {
+    update_index();
+    return _inbound[i] - _departing[i];
+  }
   int count = 0;
   for (size_t k = 0; k < vehs.size(); ++k) {
     if (vehs[k].destin == i &&
@@ -145,6 +315,17 @@ int BWSim::num_vehicles_immediately_inbound(size_t i) const {
 }
 
 int BWSim::num_vehicles_idle_by(size_t i, BWTime t) const {
+  if (indexed && t >= now) {
+    ASSERT(i < num_stations());
+    update_index();
+    int count = (int)_idle[i].size();
+    for (time_index_t::const_iterator it = _by_arrival[i].upper_bound(
+        make_pair(now, SIZE_T_MAX));
+        it != _by_arrival[i].end() && it->first <= t; ++it) {
+      ++count;
+    }
+    return count;
+  }
   int count = 0;
   for (size_t k = 0; k < vehs.size(); ++k) {
     if (vehs[k].destin == i && vehs[k].arrive <= t) {
@@ -156,6 +337,10 @@ int BWSim::num_vehicles_idle_by(size_t i, BWTime t) const {
 
 size_t BWSim::idle_veh_at(size_t i) const {
   ASSERT(i < num_stations());
+  if (indexed) {
+    update_index();
+    return _idle[i].empty() ? numeric_limits<size_t>::max() : *_idle[i].begin();
+  }
   for (size_t k = 0; k < vehs.size(); ++k) {
     if (vehs[k].destin == i && vehs[k].arrive <= now) {
       return k;
@@ -164,8 +349,56 @@ size_t BWSim::idle_veh_at(size_t i) const {
   return numeric_limits<size_t>::max();
 }
 
+size_t BWSim::first_veh_inbound(size_t i) const {
+  ASSERT(i < num_stations());
+  if (indexed) {
+    update_index();
+    return _by_arrival[i].empty() ?
+        numeric_limits<size_t>::max() : _by_arrival[i].begin()->second;
+  }
+  size_t k_first = numeric_limits<size_t>::max();
+  for (size_t k = 0; k < vehs.size(); ++k) {
+    if (vehs[k].destin == i && (k_first == numeric_limits<size_t>::max() ||
+        vehs[k].arrive < vehs[k_first].arrive)) {
+      k_first = k;
+    }
+  }
+  return k_first;
+}
+
+size_t BWSim::last_veh_inbound_by(size_t i, BWTime t) const {
+  ASSERT(i < num_stations());
+  if (indexed) {
+    update_index();
+    time_index_t::const_iterator it = _by_arrival[i].upper_bound(
+        make_pair(t, SIZE_T_MAX));
+    if (it == _by_arrival[i].begin()) {
+      return numeric_limits<size_t>::max();
+    }
+    --it;
+    // lowest index with the same arrival time
+    return _by_arrival[i].lower_bound(make_pair(it->first, (size_t)0))->second;
+  }
+  size_t k_last = numeric_limits<size_t>::max();
+  for (size_t k = 0; k < vehs.size(); ++k) {
+    if (vehs[k].destin == i && vehs[k].arrive <= t &&
+        (k_last == numeric_limits<size_t>::max() ||
+         vehs[k].arrive > vehs[k_last].arrive)) {
+      k_last = k;
+    }
+  }
+  return k_last;
+}
+
 void BWSim::count_idle_vehs(std::vector<int> &idle_vehs) const {
   CHECK(idle_vehs.size() == num_stations());
+  if (indexed) {
+    update_index();
+    for (size_t i = 0; i < num_stations(); ++i) {
+      idle_vehs[i] += (int)_idle[i].size();
+    }
+    return;
+  }
   for (size_t k = 0; k < vehs.size(); ++k) {
     if (vehs[k].arrive <= now) {
       ++(idle_vehs[vehs[k].destin]);
@@ -173,6 +406,12 @@ void BWSim::count_idle_vehs(std::vector<int> &idle_vehs) const {
   }
 }
 
+const BWVehicleArrays &BWSim::veh_arrays() const {
+  CHECK(indexed);
+  update_index();
+  return _veh_arrays;
+}
+
 void BWSimStatsDetailed::init() {
   pax_wait.clear();
   pax_wait.resize(sim.num_stations());
@@ -219,6 +458,39 @@ void BWSimStatsDetailed::record_time_step_stats() {
       idle_vehs_counter.begin(), idle_vehs_counter.end(), 0));
 }
 
+void BWSimStatsDetailed::record_time_step_stats_until(BWTime t) {
+  ASSERT(t >= sim.now);
+  BWTime steps = t - sim.now;
+  if (steps == 0)
+    return;
+
+  //
+  // queue lengths only change when a queued passenger is picked up
+  //
+  for (size_t i = 0; i < sim.num_stations(); ++i) {
+    BWTime step = sim.now;
+    while (step < t) {
+      while (!pickups[i].empty() && pickups[i].top() <= step)
+        pickups[i].pop();
+      BWTime next = pickups[i].empty() ? t : min(t, pickups[i].top());
+      queue_len[i].accumulate(pickups[i].size(), (size_t)(next - step));
+      step = next;
+    }
+  }
+
+  //
+  // idle vehicle counts do not change, because no vehicles arrive
+  //
+  idle_vehs_counter.clear();
+  idle_vehs_counter.resize(sim.num_stations(), 0);
+  sim.count_idle_vehs(idle_vehs_counter);
+  for (size_t i = 0; i < sim.num_stations(); ++i) {
+    idle_vehs[i].accumulate(idle_vehs_counter[i], (size_t)steps);
+  }
+  idle_vehs_total.accumulate(std::accumulate(
+      idle_vehs_counter.begin(), idle_vehs_counter.end(), 0), (size_t)steps);
+}
+
 void BWSimStatsDetailed::record_pax_served(const BWPax &pax,
     size_t empty_origin, BWTime pickup)
 {
@@ -275,6 +547,26 @@ void BWSimStatsPaxRecorder::record_pax_served(const BWPax &pax,
   this->records.push_back(record);
 }
 
+/**
+ * The vehicle with destin i that is available soonest: the idle vehicle at i
+ * with the lowest index, if there is one, or else the first to arrive. This is
+ * the only vehicle at i that BWNN or ETNN could choose.
+ */
+static size_t first_veh_available_at(const BWSim &sim, size_t i) {
+  size_t k = sim.idle_veh_at(i);
+  return k == numeric_limits<size_t>::max() ? sim.first_veh_inbound(i) : k;
+}
+
+/**
+ * When the sim is indexed, BWNN and ETNN can either look at one vehicle per
+ * station (see first_veh_available_at) or scan the vehicle arrays with one of
+ * the kernels in vehicle_kernels.h. The scan is faster unless there are many
+ * vehicles per station; the crossover is at roughly 10 to 20.
+ */
+static bool use_station_candidates(const BWSim &sim) {
+  return sim.vehs.size() > 16 * sim.num_stations();
+}
+
 BWTime BWNNHandler::wait(const BWPax &pax, const BWVehicle &veh) const
 {
   return max((BWTime)0, veh.arrive - pax.arrive) +
@@ -287,17 +579,109 @@ size_t BWNNHandler::handle_pax(const BWPax &pax) {
   ASSERT(pax.arrive == sim.now);
   size_t k_star = numeric_limits<size_t>::max();
   BWTime w_star = numeric_limits<BWTime>::max();
-  for (size_t k = 0; k < sim.vehs.size(); ++k) {
-    BWTime w_k = wait(pax, sim.vehs[k]);
-    if (w_k < w_star) {
-      k_star = k;
-      w_star = w_k;
+  if (sim.indexed && !use_station_candidates(sim)) {
+    bw_empty_times_to(sim.trip_time, pax.origin, _empty_time);
+    k_star = bw_nn_choose_veh(sim.veh_arrays(), _empty_time, (int)pax.arrive);
+  } else if (sim.indexed) {
+    for (size_t i = 0; i < sim.num_stations(); ++i) {
+      size_t k = first_veh_available_at(sim, i);
+      if (k == numeric_limits<size_t>::max())
+        continue;
+      BWTime w_k = wait(pax, sim.vehs[k]);
+      if (w_k < w_star || (w_k == w_star && k < k_star)) {
+        k_star = k;
+        w_star = w_k;
+      }
+    }
+  } else {
+    for (size_t k = 0; k < sim.vehs.size(); ++k) {
+      BWTime w_k = wait(pax, sim.vehs[k]);
+      if (w_k < w_star) {
+        k_star = k;
+        w_star = w_k;
+      }
     }
   }
   ASSERT(k_star != numeric_limits<size_t>::max());
   return k_star;
 }
 
+bool BWNNHandler::handle_pax_batch(const BWPax *pax, size_t num_pax,
+    size_t *vehs) {
+  // Subclasses that override handle_pax may choose differently.
+  if (typeid(*this) != typeid(BWNNHandler))
+    return false;
+
+  // Find the nearest vehicle for each passenger in the current state, in one
+  // pass over the vehicles; ties go to the lowest index, as in handle_pax.
+  const BWTime now = sim.now;
+  _batch_best.assign(num_pax,
+      make_pair(numeric_limits<BWTime>::max(), numeric_limits<size_t>::max()));
+  for (size_t k = 0; k < sim.vehs.size(); ++k) {
+    const BWVehicle &veh = sim.vehs[k];
+    BWTime delay = max((BWTime)0, veh.arrive - now);
+    for (size_t i = 0; i < num_pax; ++i) {
+      BWTime w_k = delay + sim.trip_time(veh.destin, pax[i].origin);
+      if (w_k < _batch_best[i].first) {
+        _batch_best[i] = make_pair(w_k, k);
+      }
+    }
+  }
+
+  // Assigning a vehicle changes only that vehicle, so for each passenger, the
+  // nearest vehicle is either the one found above or one of the vehicles that
+  // have been assigned to earlier passengers in the batch. If the one found
+  // above has itself been assigned, scan again.
+  for (size_t m = 0; m < _batch_moved.size(); ++m) {
+    if (_batch_moved[m].first < _batch_is_moved.size())
+      _batch_is_moved[_batch_moved[m].first] = false;
+  }
+  _batch_moved.clear();
+  _batch_is_moved.resize(sim.vehs.size(), false);
+  for (size_t i = 0; i < num_pax; ++i) {
+    ASSERT(pax[i].origin < sim.num_stations());
+    ASSERT(pax[i].destin < sim.num_stations());
+    ASSERT(pax[i].arrive == sim.now);
+    size_t k_star = _batch_best[i].second;
+    BWTime w_star = _batch_best[i].first;
+    if (k_star < sim.vehs.size() && _batch_is_moved[k_star]) {
+      k_star = numeric_limits<size_t>::max();
+      w_star = numeric_limits<BWTime>::max();
+      for (size_t k = 0; k < sim.vehs.size(); ++k) {
+        if (_batch_is_moved[k])
+          continue;
+        BWTime w_k = wait(pax[i], sim.vehs[k]);
+        if (w_k < w_star) {
+          k_star = k;
+          w_star = w_k;
+        }
+      }
+    }
+    size_t m_star = _batch_moved.size();
+    for (size_t m = 0; m < _batch_moved.size(); ++m) {
+      size_t k = _batch_moved[m].first;
+      BWTime w_k = wait(pax[i], _batch_moved[m].second);
+      if (w_k < w_star || (w_k == w_star && k < k_star)) {
+        k_star = k;
+        w_star = w_k;
+        m_star = m;
+      }
+    }
+
+    ASSERT(k_star != numeric_limits<size_t>::max());
+    vehs[i] = k_star;
+    if (m_star == _batch_moved.size()) {
+      _batch_moved.push_back(make_pair(k_star,
+          sim.veh_after_serving(sim.vehs[k_star], pax[i])));
+      _batch_is_moved[k_star] = true;
+    } else {
+      _batch_moved[m_star].second =
+          sim.veh_after_serving(_batch_moved[m_star].second, pax[i]);
+    }
+  }
+  return true;
+}
+
 size_t BWHxHandler::handle_pax(const BWPax &pax) {
   ASSERT(pax.origin < sim.num_stations());
   ASSERT(pax.destin < sim.num_stations());
@@ -338,6 +722,21 @@ BWH1Handler::BWH1Handler(BWSim &sim, boost::numeric::ublas::matrix<double> od,
   _expected_trip_time_from = prod(sim.trip_time, Pe);
 }
 
+size_t BWH1Handler::handle_pax(const BWPax &pax) {
+  if (!sim.indexed) {
+    return BWHxHandler::handle_pax(pax);
+  }
+  ASSERT(pax.origin < sim.num_stations());
+  ASSERT(pax.destin < sim.num_stations());
+  ASSERT(pax.arrive == sim.now);
+  bw_empty_times_to(sim.trip_time, pax.origin, _empty_time);
+  size_t k_star = bw_h1_choose_veh(sim.veh_arrays(), _empty_time,
+      _expected_trip_time_from, (int)pax.arrive,
+      od().expected_interarrival_time(), alpha());
+  ASSERT(k_star != SIZE_T_MAX);
+  return k_star;
+}
+
 double BWH1Handler::expected_trip_time_from(size_t i) const
 {
   ASSERT(i < _expected_trip_time_from.size());
@@ -397,20 +796,123 @@ double BWH2Handler::value(const BWPax & pax, size_t k) const
   return wait(pax, veh) + alpha() * exp_wait_max;
 }
 
+double BWH2Handler::wait_at(const BWVehicle &veh_kp, double t, size_t n,
+    size_t i) const
+{
+  // this must match the calculation in value, so that the results are equal
+  double h = od().expected_interarrival_time();
+  return max(0.0, veh_kp.arrive - (t + n*h)) + sim.trip_time(veh_kp.destin, i);
+}
+
+void BWH2Handler::build_table_entry(size_t n, size_t i) {
+  TopTwo &entry = _tables[n * sim.num_stations() + i];
+  entry.min1 = entry.min2 = numeric_limits<double>::max();
+  entry.arg1 = entry.arg2 = SIZE_T_MAX;
+  for (size_t kp = 0; kp < sim.vehs.size(); ++kp) {
+    entry.insert(wait_at(sim.vehs[kp], _tables_t, n, i), kp);
+  }
+}
+
+void BWH2Handler::update_tables(BWTime t) {
+  size_t num_stations = sim.num_stations();
+  if (!_tables_valid || _tables_t != t ||
+      _tables.size() != horizon * num_stations ||
+      _tables_vehs.size() != sim.vehs.size()) {
+    _tables_t = t;
+    _tables.resize(horizon * num_stations);
+    for (size_t n = 0; n < horizon; ++n) {
+      for (size_t i = 0; i < num_stations; ++i) {
+        build_table_entry(n, i);
+      }
+    }
+    _tables_vehs = sim.vehs;
+    _tables_valid = true;
+    return;
+  }
+
+  // Usually only the vehicle assigned to the last request has changed. If it
+  // was not one of the best two for an entry, its old wait does not matter,
+  // and we can just insert its new wait; otherwise, we have to start over.
+  for (size_t k = 0; k < sim.vehs.size(); ++k) {
+    const BWVehicle &veh = sim.vehs[k];
+    if (veh.destin == _tables_vehs[k].destin &&
+        veh.arrive == _tables_vehs[k].arrive)
+      continue;
+    _tables_vehs[k] = veh;
+    for (size_t n = 0; n < horizon; ++n) {
+      for (size_t i = 0; i < num_stations; ++i) {
+        TopTwo &entry = _tables[n * num_stations + i];
+        if (entry.arg1 == k || entry.arg2 == k) {
+          build_table_entry(n, i);
+        } else {
+          entry.insert(wait_at(veh, t, n, i), k);
+        }
+      }
+    }
+  }
+}
+
+size_t BWH2Handler::handle_pax(const BWPax &pax) {
+  ASSERT(pax.origin < sim.num_stations());
+  ASSERT(pax.destin < sim.num_stations());
+  ASSERT(pax.arrive == sim.now);
+  update_tables(pax.arrive);
+
+  // This is the same as BWHxHandler::handle_pax and value, except that the
+  // minimisation over the other vehicles comes from the tables.
+  size_t num_stations = sim.num_stations();
+  double h = od().expected_interarrival_time();
+  size_t k_star = SIZE_T_MAX;
+  double v_star = numeric_limits<double>::infinity();
+  for (size_t k = 0; k < sim.vehs.size(); ++k) {
+    double exp_wait_max = -numeric_limits<double>::infinity();
+    for (size_t n = 0; n < horizon; ++n) {
+      double exp_wait_n = 0;
+      const TopTwo *entries = &_tables[n * num_stations];
+      for (size_t i = 0; i < num_stations; ++i) {
+        exp_wait_n += od().rate_from(i) * h * entries[i].min_without(k);
+      }
+      exp_wait_max = max(exp_wait_max, exp_wait_n);
+    }
+
+    double v_k = wait(pax, sim.vehs[k]) + alpha() * exp_wait_max;
+    if (v_k < v_star) {
+      k_star = k;
+      v_star = v_k;
+    }
+  }
+  ASSERT(k_star != SIZE_T_MAX);
+  return k_star;
+}
+
 size_t BWETNNHandler::handle_pax(const BWPax &pax) {
   ASSERT(pax.origin < sim.num_stations());
   ASSERT(pax.destin < sim.num_stations());
   ASSERT(pax.arrive == sim.now);
 
+  if (sim.indexed && !use_station_candidates(sim)) {
+    bw_empty_times_to(sim.trip_time, pax.origin, _empty_time);
+    size_t ks = bw_etnn_choose_veh(sim.veh_arrays(), _empty_time, (int)sim.now);
+    ASSERT(ks != numeric_limits<size_t>::max());
+    return ks;
+  }
+
   size_t ks            = numeric_limits<size_t>::max();
   int    ks_empty      = numeric_limits<int>::max();
   BWTime ks_extra_wait = numeric_limits<BWTime>::max();
-  for (size_t k = 0; k < sim.vehs.size(); ++k) {
+  size_t num_candidates = sim.indexed ? sim.num_stations() : sim.vehs.size();
+  for (size_t c = 0; c < num_candidates; ++c) {
+    size_t k = sim.indexed ? first_veh_available_at(sim, c) : c;
+    if (k == numeric_limits<size_t>::max())
+      continue;
     int    k_empty      = sim.trip_time(sim.vehs[k].destin, pax.origin);
     BWTime k_extra_wait = max((BWTime)0, sim.vehs[k].arrive - sim.now);
 
+    // the candidates are not in order by index when the sim is indexed, so
+    // we need an explicit tie breaker on the index
     if (k_empty < ks_empty || (
-        k_empty == ks_empty && k_extra_wait < ks_extra_wait))
+        k_empty == ks_empty && (k_extra_wait < ks_extra_wait || (
+        k_extra_wait == ks_extra_wait && k < ks))))
     {
       ks = k;
       ks_empty = k_empty;
@@ -452,6 +954,45 @@ size_t BWSNNHandler::choose_veh(const BWPax &pax, const vector<BWVehicle> &vehs,
   return ks;
 }
 
+size_t BWSNNHandler::choose_veh(const BWPax &pax, const BWSim &sim) {
+  if (!sim.indexed) {
+    return choose_veh(pax, sim.vehs, sim.trip_time);
+  }
+
+  size_t ks = numeric_limits<size_t>::max();
+  int ks_empty = 0;
+  BWTime ks_arrive = 0;
+  BWTime ks_wait = 0;
+  for (size_t i = 0; i < sim.num_stations(); ++i) {
+    // Among the vehicles at i, the empty trip time is the same, so the best
+    // one is the last to arrive in time to give zero wait, if any; otherwise,
+    // it is the first to arrive.
+    int k_empty = sim.trip_time(i, pax.origin);
+    size_t k = sim.last_veh_inbound_by(i, pax.arrive - k_empty);
+    if (k == numeric_limits<size_t>::max()) {
+      k = sim.first_veh_inbound(i);
+      if (k == numeric_limits<size_t>::max())
+        continue;
+    }
+    BWTime k_arrive = sim.vehs[k].arrive + k_empty;
+    BWTime k_wait = max((BWTime)0, k_arrive - pax.arrive);
+
+    bool new_ks = ks == numeric_limits<size_t>::max() ||
+        k_wait   <  ks_wait   || (
+        k_wait   == ks_wait   && (k_empty  < ks_empty || (
+        k_empty  == ks_empty  && (k_arrive > ks_arrive || (
+        k_arrive == ks_arrive && k < ks)))));
+    if (new_ks) {
+      ks = k;
+      ks_empty = k_empty;
+      ks_arrive = k_arrive;
+      ks_wait = k_wait;
+    }
+  }
+
+  return ks;
+}
+
 BWTime BWSNNHandler::update_veh(const BWPax &pax, BWVehicle &veh,
     const boost::numeric::ublas::matrix<int> &trip_time) {
   int ks_empty = trip_time(veh.destin, pax.origin);
@@ -466,26 +1007,51 @@ BWTime BWSNNHandler::update_veh(const BWPax &pax, BWVehicle &veh,
 }
 
 size_t BWSNNHandler::handle_pax(const BWPax &pax) {
-  size_t k_star = BWSNNHandler::choose_veh(pax, sim.vehs, sim.trip_time);
+  size_t k_star = BWSNNHandler::choose_veh(pax, sim);
 
   // Update sim state here, because we're not following the usual update rules.
   size_t empty_origin = sim.vehs[k_star].destin;
   BWTime pickup = BWSNNHandler::update_veh(pax,
       sim.vehs[k_star], sim.trip_time);
+  sim.veh_changed(k_star);
   sim.stats->record_pax_served(pax, empty_origin, pickup);
 
   return numeric_limits<size_t>::max(); // sim state already updated
 }
 
 BWPoissonPaxStream::BWPoissonPaxStream(double now,
-    boost::numeric::ublas::matrix<double> od) : last_time(now), _od(od) {
+    boost::numeric::ublas::matrix<double> od, EmpiricalSamplerMethod method) :
+    last_time(now), batch_size(1), _od(od, method), _rng(NULL) {
+}
+
+void BWPoissonPaxStream::reset(double now) {
+  last_time = now;
+  _buffer.clear();
+}
+
+BWPaxStream *BWPoissonPaxStream::clone(RNG &rng) const {
+  BWPoissonPaxStream *copy = new BWPoissonPaxStream(*this);
+  copy->_rng = &rng;
+  copy->_buffer.clear();
+  return copy;
 }
 
 BWPax BWPoissonPaxStream::next_pax() {
   BWPax pax;
   double interval;
-  _od.sample(BYREF pax.origin, BYREF pax.destin, BYREF interval);
+  size_t origin, destin;
+  RNG &gen = _rng ? *_rng : rng.get();
+  if (batch_size > 1) {
+    _buffer.sample(_od, batch_size, BYREF origin, BYREF destin,
+        BYREF interval, gen);
+  } else {
+    _od.sample(BYREF origin, BYREF destin, BYREF interval, gen);
+  }
   last_time += interval;
+  CHECK_MSG(last_time < numeric_limits<BWTime>::max(),
+      "arrival time does not fit in BWTime; see SI_TAXI_TIME_BITS");
+  pax.origin = origin;
+  pax.destin = destin;
   pax.arrive = (BWTime)round(last_time);
   return pax;
 }
@@ -6,15 +6,20 @@
 #include <si_taxi/od_matrix_wrapper.h>
 
 #include <queue>
+#include <set>
 
 namespace si_taxi {
 
 /**
- * A 32-bit time index is typically adequate.
+ * A 32-bit time index is typically adequate; see SI_TAXI_TIME_BITS.
  *
  * Differences of times are often computed, so a signed type is needed.
  */
+#if SI_TAXI_TIME_BITS == 32
+typedef int BWTime;
+#else
 typedef long BWTime;
+#endif
 
 /**
  * A simple vehicle; it is slightly more general than the Bell and Wong
@@ -29,9 +34,9 @@ typedef long BWTime;
  */
 struct BWVehicle {
   /// Index of origin station of last leg of vehicle's journey to destin.
-  size_t origin;
+  StationIndex origin;
   /// Index of final destination station.
-  size_t destin;
+  StationIndex destin;
   /// Time at which vehicle arrived or will arrive at destin; the simulation
   /// starts at time 0.
   BWTime arrive;
@@ -47,12 +52,40 @@ struct BWVehicle {
     origin(destin), destin(destin), arrive(arrive) { }
 };
 
+/**
+ * The same state as a vector of BWVehicles, but stored as one array per field,
+ * with 32-bit fields. This layout is better suited to loops that look at every
+ * vehicle (see vehicle_kernels.h). BWSim keeps one up to date when indexed.
+ */
+struct BWVehicleArrays {
+  /// see BWVehicle::origin
+  std::vector<int> origin;
+  /// see BWVehicle::destin
+  std::vector<int> destin;
+  /// see BWVehicle::arrive
+  std::vector<int> arrive;
+
+  /// Number of vehicles.
+  inline size_t size() const {
+    return arrive.size();
+  }
+
+  /// Set the number of vehicles; new vehicles are not initialised.
+  void resize(size_t num_veh);
+
+  /// Store veh as vehicle k; its fields must fit in 32 bits.
+  void set(size_t k, const BWVehicle &veh);
+
+  /// Vehicle k as a BWVehicle.
+  BWVehicle get(size_t k) const;
+};
+
 /**
  * Passenger.
  */
 struct BWPax {
-  size_t origin;
-  size_t destin;
+  StationIndex origin;
+  StationIndex destin;
   BWTime arrive;
 
   BWPax() { }
@@ -79,6 +112,17 @@ struct BWPaxStream {
    * at time 'now.'
    */
   virtual void reset(double now) = 0;
+
+  /**
+   * Make a copy of this stream that draws its random numbers from the given
+   * generator instead of rng, so that copies can be used in different
+   * threads; the caller must delete the copy. The default implementation
+   * returns NULL, which means that the stream can't be copied.
+   */
+  virtual BWPaxStream *clone(RNG &/*rng*/) const { return NULL; }
+
+  /// generator for requests; draws from si_taxi::rng until seeded
+  RNGStream rng;
 };
 
 struct BWReactiveHandler;  // forward declaration
@@ -107,12 +151,48 @@ struct BWSimStats;         // forward declaration
  *    is called for all vehicles at the start of the sim, _except_ for those
  *    that were assigned trips due to passengers arriving at time 0.
  * 2) The strobe also fires when t = 0.
+ *
+ * If event_driven is set, the order of operations is the same, but time steps
+ * in which no vehicle becomes idle and the strobe does not fire are skipped
+ * (apart from stats->record_time_step_stats_until, which records them in one
+ * call). The sim finds the next idle event using an event calendar, which is
+ * kept up to date by move_empty and serve_pax; if you change vehs directly
+ * (other than by adding vehicles), call veh_changed.
+ *
+ * If indexed is set, the sim also keeps per-station sets of inbound and idle
+ * vehicles, so the vehicle counting queries (num_vehicles_inbound, idle_veh_at,
+ * etc.) do not have to scan vehs. The same rule about changing vehs directly
+ * applies.
+ *
+ * If coalesce_events is set, the order of operations is also the same, but
+ * proactive->handle_pax_served, handle_idle and handle_strobe are not called;
+ * instead, proactive->handle_coalesced_events is called once at the end of
+ * each time step in which any of them would have been called (after step 4).
+ * This suits handlers that recompute a full redistribution in response to
+ * any event, such as the DTP and sampling and voting handlers.
+ *
+ * If batch_pax is set, passengers that arrive in the same time step and are
+ * given to handle_pax_batch or handle_pax_stream together are assigned in one
+ * call to reactive->handle_pax_batch. The handler chooses the vehicles as if
+ * the passengers were served one at a time, but proactive->handle_pax_served
+ * is called for each passenger only after they have all been served. If
+ * coalesce_events is also set, the results are therefore the same as without
+ * batch_pax. Reactive handlers that do not support batches fall back to
+ * handle_pax.
  */
 struct BWSim {
   /// Current simulation time.
   BWTime now;
   /// Run the proactive handler at this interval.
   BWTime strobe;
+  /// Skip time steps in which nothing happens; see notes above.
+  bool event_driven;
+  /// Maintain per-station vehicle indexes for the queries; see notes above.
+  bool indexed;
+  /// Call the proactive handler at most once per time step; see notes above.
+  bool coalesce_events;
+  /// Assign passengers that arrive together in batches; see notes above.
+  bool batch_pax;
   /// Callback for immediate assignment of request to vehicle.
   BWReactiveHandler *reactive;
   /// Callbacks that can initiate proactive empty vehicle trips.
@@ -123,8 +203,14 @@ struct BWSim {
   boost::numeric::ublas::matrix<int> trip_time;
   /// Statistics collection.
   BWSimStats *stats;
+  /// Generator for handlers that need random numbers (e.g. sampling and
+  /// voting); draws from si_taxi::rng until seeded.
+  RNGStream rng;
 
-  BWSim() : now(0), strobe(0), reactive(NULL), proactive(NULL), stats(NULL) { }
+  BWSim() : now(0), strobe(0), event_driven(false), indexed(false),
+      coalesce_events(false), batch_pax(false), reactive(NULL),
+      proactive(NULL), stats(NULL), _events_pending(false),
+      _calendar_vehs(SIZE_T_MAX), _index_valid(false), _index_now(0) { }
 
   /**
    * Number of stations (or zones); this is based on the trip times.
@@ -150,6 +236,26 @@ struct BWSim {
    */
   void add_vehicles_in_turn(size_t num_veh, size_t station=0);
 
+  /**
+   * Add idle vehicles according to the given counts: counts[i] vehicles at
+   * station i. The new vehicles are added in order by station.
+   *
+   * This is useful for restoring a saved distribution of vehicles.
+   *
+   * @param counts num_stations non-negative entries
+   */
+  void add_vehicles_at(const std::vector<int> &counts);
+
+  /**
+   * Add num_veh idle vehicles, distributed in proportion to the given weights
+   * (e.g. BWDynamicTransportationProblemHandler::targets); see apportion and
+   * add_vehicles_at.
+   *
+   * @param weights num_stations non-negative entries, not all zero
+   */
+  void add_vehicles_in_proportion(size_t num_veh,
+      const std::vector<double> &weights);
+
   /**
    * Park all existing vehicles; park one vehicle at each station, starting at
    * the given station. Whereas add_vehicles_in_turn adds new vehicles, this
@@ -176,11 +282,22 @@ struct BWSim {
    */
   void handle_pax(const BWPax & pax);
 
+  /**
+   * Handle num_pax passengers, which must be in non-decreasing order by
+   * arrival time. If batch_pax is set, the passengers that arrive in each time
+   * step are assigned together (see notes above); otherwise, this is the same
+   * as calling handle_pax for each passenger in turn.
+   *
+   * @param pax not null if num_pax > 0
+   */
+  void handle_pax_batch(const BWPax *pax, size_t num_pax);
+
   /**
    * Generate and handle num_pax passengers.
    *
    * This is here for efficiency reasons: it avoids the overhead of calling
-   * handle_pax through the wrapper for each passenger.
+   * handle_pax through the wrapper for each passenger. If batch_pax is set,
+   * the passengers that arrive in the same time step are assigned together.
    *
    * @param num_pax non-negative; number of requests to generate
    * @param pax_stream not null
@@ -210,6 +327,18 @@ struct BWSim {
    */
   void serve_pax(size_t k, const BWPax &pax);
 
+  /**
+   * The state that veh would be in after serving pax now; see serve_pax.
+   */
+  BWVehicle veh_after_serving(const BWVehicle &veh, const BWPax &pax) const;
+
+  /**
+   * Tell the sim that vehicle k's destin or arrive time has been changed
+   * directly, rather than by move_empty or serve_pax. This is only required
+   * when event_driven or indexed is set (but it is cheap to call otherwise).
+   */
+  void veh_changed(size_t k);
+
   /**
    * Number of vehicles that have destination i; these may be moving to i or
    * idle at i.
@@ -239,6 +368,21 @@ struct BWSim {
    */
   size_t idle_veh_at(size_t i) const;
 
+  /**
+   * Index of the vehicle with destination i that arrives first (lowest index
+   * on ties), or numeric_limits<size_t>::max() if there are none. Note that
+   * this looks at arrive only, so it need not be the lowest-indexed idle
+   * vehicle at i; see idle_veh_at.
+   */
+  size_t first_veh_inbound(size_t i) const;
+
+  /**
+   * Index of the vehicle with destination i that arrives last at or before
+   * time t (lowest index on ties), or numeric_limits<size_t>::max() if there
+   * are none.
+   */
+  size_t last_veh_inbound_by(size_t i, BWTime t) const;
+
   /**
    * Count idle vehicles and provide some summary stats.
    *
@@ -246,6 +390,103 @@ struct BWSim {
    * idle vehicle counts; non-negative
    */
   void count_idle_vehs(std::vector<int> &idle_vehs) const;
+
+  /**
+   * The vehicle state in BWVehicleArrays form; the sim must be indexed.
+   */
+  const BWVehicleArrays &veh_arrays() const;
+
+protected:
+  /*
+   * The simulation loop behind run_to and handle_pax. The Dispatch object
+   * makes the calls to the handlers and stats: BWSim's own methods use
+   * BWSimVirtualDispatch, and BWSimT calls the concrete types directly. The
+   * definitions are in bell_wong_t.h.
+   */
+
+  /// See run_to.
+  template <typename Dispatch> void run_to_with(BWTime t, Dispatch &d);
+
+  /// See handle_pax.
+  template <typename Dispatch>
+  void handle_pax_with(const BWPax &pax, Dispatch &d);
+
+  /// See handle_pax_batch.
+  template <typename Dispatch>
+  void handle_pax_batch_with(const BWPax *pax, size_t num_pax, Dispatch &d);
+
+  /// See handle_pax_stream.
+  template <typename Dispatch>
+  void handle_pax_stream_with(size_t num_pax, BWPaxStream *pax_stream,
+      Dispatch &d);
+
+  /// Call handle_idle for vehicles that become idle at now.
+  template <typename Dispatch> void handle_idle_events(Dispatch &d);
+
+  /// Run the strobe (if it fires at now) and any coalesced events; this ends
+  /// the time step.
+  template <typename Dispatch> void handle_end_of_step_events(Dispatch &d);
+
+private:
+  /// (arrive, vehicle index) pairs, earliest first; entries go stale when a
+  /// vehicle is reassigned, so they are checked against vehs when popped
+  typedef std::priority_queue<std::pair<BWTime, size_t>,
+    std::vector<std::pair<BWTime, size_t> >,
+    std::greater<std::pair<BWTime, size_t> > > calendar_t;
+
+  /// Rebuild the event calendar from vehs.
+  void build_calendar();
+
+  /// Time of the next idle or strobe event in [now, t), or t if there is none.
+  BWTime next_event_time(BWTime t);
+
+  /// see coalesce_events; true if the proactive handler has missed an event
+  /// in the current time step
+  bool _events_pending;
+
+  /// see batch_pax; passengers from the stream that arrive at the same time
+  std::vector<BWPax> _pax_batch;
+  /// see batch_pax; vehicles chosen by reactive->handle_pax_batch
+  std::vector<size_t> _batch_vehs;
+
+  /// see event_driven
+  calendar_t _calendar;
+  /// number of vehicles when the calendar was built; SIZE_T_MAX if invalid
+  size_t _calendar_vehs;
+
+  /// (time, vehicle index) pairs, earliest first
+  typedef std::set<std::pair<BWTime, size_t> > time_index_t;
+
+  /// Bring the indexes up to date with vehs and now; the queries call this.
+  void update_index() const;
+
+  /// Rebuild the indexes from vehs.
+  void build_index() const;
+
+  /// Add vehicle k (as it is now) to the indexes.
+  void index_veh(size_t k) const;
+
+  /// Remove vehicle k (as it was when it was indexed) from the indexes.
+  void unindex_veh(size_t k) const;
+
+  /// false if vehs has changed in a way that the indexes did not see
+  mutable bool _index_valid;
+  /// time up to which arriving vehicles have been moved into _idle
+  mutable BWTime _index_now;
+  /// state of each vehicle when it was last indexed
+  mutable BWVehicleArrays _veh_arrays;
+  /// number of vehicles with destin i
+  mutable std::vector<int> _inbound;
+  /// number of vehicles with destin i that have not started the last leg
+  mutable std::vector<int> _departing;
+  /// vehicles idle at station i, in ascending order by index
+  mutable std::vector<std::set<size_t> > _idle;
+  /// vehicles with destin i, in order of arrival
+  mutable std::vector<time_index_t> _by_arrival;
+  /// all moving vehicles, in order of arrival
+  mutable time_index_t _arrivals;
+  /// all vehicles that have not started their last leg, in order of departure
+  mutable time_index_t _departures;
 };
 
 struct BWReactiveHandler {
@@ -273,6 +514,26 @@ struct BWReactiveHandler {
    */
   virtual size_t handle_pax(const BWPax &pax) = 0;
 
+  /**
+   * Assign vehicles to serve several passengers that arrived at the same time
+   * (see BWSim::batch_pax). The vehicles must be the ones that handle_pax
+   * would choose if each passenger were served (see BWSim::serve_pax) before
+   * the next was handled; the sim serves them after this returns.
+   *
+   * @param pax num_pax passengers; pax[i].arrive == sim.now
+   *
+   * @param vehs [out] num_pax entries; the vehicle for each passenger, as
+   * returned by handle_pax, except that the handler must not update the
+   * vehicle state itself
+   *
+   * @return false if the handler does not support batches, in which case the
+   * sim calls handle_pax for each passenger; the default returns false
+   */
+  inline virtual bool handle_pax_batch(const BWPax * /*pax*/,
+      size_t /*num_pax*/, size_t * /*vehs*/) {
+    return false;
+  }
+
   /**
    * The simulation to which this handler is attached.
    */
@@ -320,6 +581,15 @@ struct BWProactiveHandler {
    */
   inline virtual void handle_strobe() { }
 
+  /**
+   * Called at the end of a time step in place of the other callbacks, when
+   * the sim is set to coalesce events (see BWSim::coalesce_events).
+   *
+   * By default, this calls handle_strobe, which should be a full
+   * redistribution.
+   */
+  inline virtual void handle_coalesced_events() { handle_strobe(); }
+
   /**
    * The simulation to which this handler is attached.
    */
@@ -347,6 +617,19 @@ struct BWSimStats {
    */
   inline virtual void record_time_step_stats() { };
 
+  /**
+   * Called by an event driven sim (see BWSim::event_driven) in place of
+   * record_time_step_stats for the time steps from sim.now (inclusive) to t
+   * (exclusive); no vehicle becomes idle and no strobe fires in these steps.
+   *
+   * By default, this just calls record_time_step_stats for each step.
+   */
+  virtual void record_time_step_stats_until(BWTime t) {
+    for (; sim.now < t; ++sim.now) {
+      record_time_step_stats();
+    }
+  }
+
   /**
    * Record statistics for given passenger.
    */
@@ -379,6 +662,9 @@ struct BWSimStatsDetailed : public BWSimStats {
   /// override
   virtual void record_time_step_stats();
 
+  /// override; queue lengths and idle vehicle counts are piecewise constant
+  virtual void record_time_step_stats_until(BWTime t);
+
   /// override
   virtual void record_pax_served(const BWPax &pax, size_t empty_origin,
       BWTime pickup);
@@ -426,6 +712,9 @@ struct BWSimStatsMeanPaxWait : public BWSimStats {
   /// override
   virtual void init();
 
+  /// override; nothing to record
+  inline virtual void record_time_step_stats_until(BWTime t) { }
+
   /**
    * Record statistics for given passenger.
    */
@@ -440,7 +729,7 @@ struct BWSimStatsMeanPaxWait : public BWSimStats {
  * Record of the service of a single passenger; see BWSimStatsPaxRecorder.
  */
 struct BWSimStatsPaxRecord : public BWPax {
-  size_t empty_origin;
+  StationIndex empty_origin;
   BWTime pickup;
 };
 
@@ -454,6 +743,9 @@ struct BWSimStatsPaxRecorder : public BWSimStats {
   /// override
   virtual void init();
 
+  /// override; nothing to record
+  inline virtual void record_time_step_stats_until(BWTime t) { }
+
   /// override
   virtual void record_pax_served(const BWPax &pax, size_t empty_origin,
       BWTime pickup);
@@ -476,9 +768,36 @@ struct BWSimStatsPaxRecorder : public BWSimStats {
 struct BWNNHandler : public BWReactiveHandler {
   explicit inline BWNNHandler(BWSim &sim) : BWReactiveHandler(sim) { }
   virtual ~BWNNHandler() { }
+
+  /**
+   * If the sim is indexed (see BWSim::indexed), this looks at only one
+   * vehicle per station, or it scans the vehicles with bw_nn_choose_veh,
+   * whichever is likely to be faster; the choice is the same.
+   */
   virtual size_t handle_pax(const BWPax &pax);
 
+  /**
+   * Override. This finds the nearest vehicle for every passenger in one pass
+   * over the vehicles; after that, only the vehicles assigned earlier in the
+   * batch have to be looked at again. Subclasses that override handle_pax
+   * get the default (one passenger at a time), unless they override this too.
+   */
+  virtual bool handle_pax_batch(const BWPax *pax, size_t num_pax,
+      size_t *vehs);
+
   BWTime wait(const BWPax &pax, const BWVehicle &veh) const;
+
+protected:
+  /// scratch space for handle_pax; see bw_empty_times_to
+  std::vector<int> _empty_time;
+  /// scratch space for handle_pax_batch; best vehicle for each passenger
+  std::vector<std::pair<BWTime, size_t> > _batch_best;
+  /// scratch space for handle_pax_batch; vehicles assigned so far, with their
+  /// new states
+  std::vector<std::pair<size_t, BWVehicle> > _batch_moved;
+  /// scratch space for handle_pax_batch; true for the vehicles in
+  /// _batch_moved
+  std::vector<bool> _batch_is_moved;
 };
 
 /**
@@ -537,6 +856,12 @@ struct BWH1Handler : public BWHxHandler {
       boost::numeric::ublas::matrix<double> od, double alpha);
   virtual ~BWH1Handler() { }
 
+  /**
+   * If the sim is indexed (see BWSim::indexed), this uses bw_h1_choose_veh to
+   * scan the vehicles; the choice is the same.
+   */
+  virtual size_t handle_pax(const BWPax &pax);
+
   /**
    * Expected trip time for an occupied trip from station i.
    */
@@ -563,9 +888,19 @@ private:
 struct BWH2Handler : public BWHxHandler {
   explicit inline BWH2Handler(BWSim &sim,
       boost::numeric::ublas::matrix<double> od, double alpha, size_t horizon) :
-      BWHxHandler(sim, od, alpha), horizon(horizon) { }
+      BWHxHandler(sim, od, alpha), horizon(horizon), _tables_valid(false) { }
   virtual ~BWH2Handler() { }
 
+  /**
+   * Same choice as BWHxHandler::handle_pax, but faster: evaluating value for
+   * every vehicle takes O(horizon * stations * vehicles^2) time, because of
+   * the minimisation over the other vehicles. This keeps, for each step and
+   * station, the best and second best of the other vehicles, so that the
+   * minimisation takes constant time. The tables are updated (rather than
+   * rebuilt) for later requests at the same time.
+   */
+  virtual size_t handle_pax(const BWPax &pax);
+
   /**
    * The objective to be minimized (equation 14 for H2).
    */
@@ -575,6 +910,51 @@ struct BWH2Handler : public BWHxHandler {
    * Parameter 'N' in equation 14.
    */
   size_t horizon;
+
+private:
+  /// The two lowest waits at a station for a given step, and their vehicles.
+  struct TopTwo {
+    double min1;
+    size_t arg1;
+    double min2;
+    size_t arg2;
+
+    /// Add vehicle k with wait w.
+    inline void insert(double w, size_t k) {
+      if (w < min1) {
+        min2 = min1;
+        arg2 = arg1;
+        min1 = w;
+        arg1 = k;
+      } else if (w < min2) {
+        min2 = w;
+        arg2 = k;
+      }
+    }
+
+    /// The lowest wait that does not use vehicle k.
+    inline double min_without(size_t k) const {
+      return k == arg1 ? min2 : min1;
+    }
+  };
+
+  /// The wait in value for vehicle kp to serve station i at step n.
+  double wait_at(const BWVehicle &veh_kp, double t, size_t n, size_t i) const;
+
+  /// Bring the tables up to date for a request at time t.
+  void update_tables(BWTime t);
+
+  /// Rebuild one entry of the tables from scratch.
+  void build_table_entry(size_t n, size_t i);
+
+  /// tables of top two waits, indexed by step * num_stations + station
+  std::vector<TopTwo> _tables;
+  /// time that the tables are for
+  BWTime _tables_t;
+  /// false if the tables must be rebuilt
+  bool _tables_valid;
+  /// vehicle states that the tables are for
+  std::vector<BWVehicle> _tables_vehs;
 };
 
 /**
@@ -586,7 +966,16 @@ struct BWH2Handler : public BWHxHandler {
 struct BWETNNHandler : public BWReactiveHandler {
   explicit inline BWETNNHandler(BWSim &sim) : BWReactiveHandler(sim) { }
   virtual ~BWETNNHandler() { }
+
+  /**
+   * Like BWNNHandler::handle_pax, this looks at only one vehicle per station
+   * or uses bw_etnn_choose_veh if the sim is indexed.
+   */
   virtual size_t handle_pax(const BWPax &pax);
+
+private:
+  /// scratch space for handle_pax; see bw_empty_times_to
+  std::vector<int> _empty_time;
 };
 
 /**
@@ -605,6 +994,15 @@ struct BWSNNHandler : public BWReactiveHandler {
   static size_t choose_veh(const BWPax &pax, const std::vector<BWVehicle> &vehs,
       const boost::numeric::ublas::matrix<int> &trip_time);
 
+  /**
+   * Same choice as choose_veh for the sim's vehicles, but this only looks at
+   * the one vehicle at each station that could be chosen; it is faster when
+   * the sim is indexed (see BWSim::indexed).
+   *
+   * @return index of chosen vehicle (k_star)
+   */
+  static size_t choose_veh(const BWPax &pax, const BWSim &sim);
+
   /**
    * Update chosen vehicle (see choose_veh) to serve pax.
    *
@@ -625,18 +1023,31 @@ struct BWPoissonPaxStream : public BWPaxStream {
   /**
    * @param now non-negative; the first request arrives some time after now
    * @param od used to generate the requests; entries in vehicles per second
+   * @param method see EmpiricalSamplerMethod
    */
-  BWPoissonPaxStream(double now, boost::numeric::ublas::matrix<double> od);
+  BWPoissonPaxStream(double now, boost::numeric::ublas::matrix<double> od,
+      EmpiricalSamplerMethod method=EMPIRICAL_SAMPLER_BINARY_SEARCH);
 
   /// override
   virtual BWPax next_pax();
 
   /// override
-  inline virtual void reset(double now) { last_time = now; }
+  virtual void reset(double now);
+
+  /// override
+  virtual BWPaxStream *clone(RNG &rng) const;
 
   /// time at which the last request was be generated, in seconds
   double last_time;
 
+  /**
+   * If more than one, generate requests this many at a time (see
+   * ODMatrixWrapper::sample_batch); default 1. The requests are the same
+   * as for one at a time if nothing else draws from the same generator in
+   * between. Requests left over are discarded by reset.
+   */
+  size_t batch_size;
+
   /**
    * Demand matrix with entries in vehicle trips / second.
    */
@@ -647,6 +1058,10 @@ struct BWPoissonPaxStream : public BWPaxStream {
 protected:
   /// see od()
   ODMatrixWrapper _od;
+  /// generator for requests, set by clone; NULL to use rng
+  RNG *_rng;
+  /// see batch_size
+  ODSampleBuffer _buffer;
 };
 
 /**
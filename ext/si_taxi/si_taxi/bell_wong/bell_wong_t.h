@@ -0,0 +1,355 @@
+#ifndef SI_TAXI_BELL_WONG_T_H_
+#define SI_TAXI_BELL_WONG_T_H_
+
+#include "bell_wong.h"
+
+#include <si_taxi/utility.h>
+#include <typeinfo>
+
+namespace si_taxi {
+
+/**
+ * Calls a BWSim's handlers and stats through their virtual methods; see
+ * BWSim::run_to_with.
+ */
+struct BWSimVirtualDispatch {
+  explicit BWSimVirtualDispatch(BWSim &sim) : sim(sim) { }
+
+  inline size_t handle_pax(const BWPax &pax) {
+    return sim.reactive->handle_pax(pax);
+  }
+  inline bool handle_pax_batch(const BWPax *pax, size_t num_pax,
+      size_t *vehs) {
+    return sim.reactive->handle_pax_batch(pax, num_pax, vehs);
+  }
+  inline void handle_pax_served(size_t empty_origin) {
+    sim.proactive->handle_pax_served(empty_origin);
+  }
+  inline void handle_idle(BWVehicle &veh) {
+    sim.proactive->handle_idle(veh);
+  }
+  inline void handle_strobe() {
+    sim.proactive->handle_strobe();
+  }
+  inline void handle_coalesced_events() {
+    sim.proactive->handle_coalesced_events();
+  }
+  inline void record_time_step_stats() {
+    sim.stats->record_time_step_stats();
+  }
+  inline void record_time_step_stats_until(BWTime t) {
+    sim.stats->record_time_step_stats_until(t);
+  }
+
+  BWSim &sim;
+};
+
+/**
+ * Calls the methods of the given handler and stats types directly, rather
+ * than through the vtable, so they can be inlined (and empty ones compiled
+ * away); see BWSimT.
+ */
+template <typename Reactive, typename Proactive, typename Stats>
+struct BWSimStaticDispatch {
+  BWSimStaticDispatch() : reactive(NULL), proactive(NULL), stats(NULL) { }
+
+  inline size_t handle_pax(const BWPax &pax) {
+    return reactive->Reactive::handle_pax(pax);
+  }
+  inline bool handle_pax_batch(const BWPax *pax, size_t num_pax,
+      size_t *vehs) {
+    return reactive->Reactive::handle_pax_batch(pax, num_pax, vehs);
+  }
+  inline void handle_pax_served(size_t empty_origin) {
+    proactive->Proactive::handle_pax_served(empty_origin);
+  }
+  inline void handle_idle(BWVehicle &veh) {
+    proactive->Proactive::handle_idle(veh);
+  }
+  inline void handle_strobe() {
+    proactive->Proactive::handle_strobe();
+  }
+  inline void handle_coalesced_events() {
+    proactive->Proactive::handle_coalesced_events();
+  }
+  inline void record_time_step_stats() {
+    stats->Stats::record_time_step_stats();
+  }
+  inline void record_time_step_stats_until(BWTime t) {
+    stats->Stats::record_time_step_stats_until(t);
+  }
+
+  Reactive *reactive;
+  Proactive *proactive;
+  Stats *stats;
+};
+
+/**
+ * A BWSim whose handlers and stats have types that are known at compile
+ * time. The simulation loop (run_to, handle_pax, handle_pax_batch and
+ * handle_pax_stream) is
+ * the same as BWSim's, but it calls the handlers and stats directly, so hooks
+ * that do nothing (e.g. BWSimStats::record_time_step_stats, which BWSim calls
+ * every time step) cost nothing, and small handlers can be inlined.
+ *
+ * Other calls, such as those from move_empty and the handlers themselves,
+ * still go through reactive, proactive and stats; set_handlers sets these to
+ * the same objects. A BWSimT can be passed to anything that takes a BWSim,
+ * but calls to run_to and handle_pax through a BWSim reference or pointer
+ * use BWSim's (virtual) loop; the results are the same.
+ *
+ * Example:
+ *   BWSimT<BWNNHandler, BWDynamicTransportationProblemHandler,
+ *     BWSimStatsMeanPaxWait> sim;
+ *   ... set trip times, add vehicles ...
+ *   BWNNHandler reactive(sim);
+ *   BWDynamicTransportationProblemHandler proactive(sim);
+ *   BWSimStatsMeanPaxWait stats(sim);
+ *   sim.set_handlers(reactive, proactive, stats);
+ *   sim.init();
+ */
+template <typename Reactive, typename Proactive, typename Stats>
+struct BWSimT : public BWSim {
+  BWSimT() { }
+
+  /**
+   * Set the handlers and stats. Because their methods are called directly,
+   * the objects must be of exactly the given types, not subclasses of them.
+   */
+  void set_handlers(Reactive &reactive, Proactive &proactive, Stats &stats) {
+    CHECK(typeid(reactive) == typeid(Reactive));
+    CHECK(typeid(proactive) == typeid(Proactive));
+    CHECK(typeid(stats) == typeid(Stats));
+    _dispatch.reactive = &reactive;
+    _dispatch.proactive = &proactive;
+    _dispatch.stats = &stats;
+    this->reactive = &reactive;
+    this->proactive = &proactive;
+    this->stats = &stats;
+  }
+
+  /// see BWSim::run_to
+  void run_to(BWTime t) {
+    check_handlers();
+    run_to_with(t, _dispatch);
+  }
+
+  /// see BWSim::handle_pax
+  void handle_pax(const BWPax &pax) {
+    check_handlers();
+    handle_pax_with(pax, _dispatch);
+  }
+
+  /// see BWSim::handle_pax_batch
+  void handle_pax_batch(const BWPax *pax, size_t num_pax) {
+    check_handlers();
+    handle_pax_batch_with(pax, num_pax, _dispatch);
+  }
+
+  /// see BWSim::handle_pax_stream
+  void handle_pax_stream(size_t num_pax, BWPaxStream *pax_stream) {
+    check_handlers();
+    handle_pax_stream_with(num_pax, pax_stream, _dispatch);
+  }
+
+protected:
+  /// The base class pointers must not have been changed since set_handlers.
+  inline void check_handlers() const {
+    ASSERT(this->reactive == _dispatch.reactive);
+    ASSERT(this->proactive == _dispatch.proactive);
+    ASSERT(this->stats == _dispatch.stats);
+  }
+
+  BWSimStaticDispatch<Reactive, Proactive, Stats> _dispatch;
+};
+
+template <typename Dispatch>
+void BWSim::run_to_with(BWTime t, Dispatch &d) {
+  ASSERT(this->reactive);
+  ASSERT(this->proactive);
+  ASSERT(this->stats);
+  ASSERT(t >= now);
+
+  if (event_driven) {
+    if (_calendar_vehs != vehs.size()) {
+      build_calendar();
+    }
+    while (now < t) {
+      BWTime next = next_event_time(t);
+      if (next > now) {
+        // nothing happens until next; record stats for the skipped steps
+        d.record_time_step_stats_until(next);
+        now = next;
+      } else {
+        d.record_time_step_stats();
+        handle_idle_events(d);
+        handle_end_of_step_events(d);
+        ++now;
+      }
+    }
+    return;
+  }
+
+  for (; now < t; ++now) {
+    // record queue lengths and vehicle states
+    d.record_time_step_stats();
+
+    // Catch up on vehicle idle events.
+    for (size_t k = 0; k < vehs.size(); ++k) {
+      if (vehs[k].arrive == now) {
+        if (coalesce_events) {
+          _events_pending = true;
+          break;
+        }
+        d.handle_idle(vehs[k]);
+      }
+    }
+
+    // Catch up on strobe events if strobe is enabled (and coalesced events).
+    handle_end_of_step_events(d);
+  }
+}
+
+template <typename Dispatch>
+void BWSim::handle_pax_with(const BWPax &pax, Dispatch &d) {
+  ASSERT(pax.origin < num_stations());
+  ASSERT(pax.destin < num_stations());
+
+  // Run the sim up to just before the passenger's arrival...
+  run_to_with(pax.arrive, d);
+
+  // then handle the new arrival.
+  size_t k = d.handle_pax(pax);
+  if (k != std::numeric_limits<size_t>::max()) {
+    size_t empty_origin = vehs.at(k).destin;
+    serve_pax(k, pax);
+    if (coalesce_events) {
+      _events_pending = true;
+    } else {
+      d.handle_pax_served(empty_origin);
+    }
+  }
+}
+
+template <typename Dispatch>
+void BWSim::handle_pax_batch_with(const BWPax *pax, size_t num_pax,
+    Dispatch &d) {
+  ASSERT(num_pax == 0 || pax);
+  if (!batch_pax) {
+    for (size_t i = 0; i < num_pax; ++i) {
+      handle_pax_with(pax[i], d);
+    }
+    return;
+  }
+
+  size_t i = 0;
+  while (i < num_pax) {
+    // Find the passengers [i, j) that arrive at the same time as pax[i].
+    size_t j = i + 1;
+    while (j < num_pax && pax[j].arrive == pax[i].arrive) {
+      ++j;
+    }
+    ASSERT(j == num_pax || pax[j].arrive > pax[i].arrive);
+
+    size_t n = j - i;
+    bool batched = false;
+    if (n > 1) {
+      run_to_with(pax[i].arrive, d);
+      _batch_vehs.resize(n);
+      batched = d.handle_pax_batch(pax + i, n, &_batch_vehs[0]);
+    }
+
+    if (batched) {
+      // Serve them all, then tell the proactive handler; the empty origin for
+      // each passenger is saved in _batch_vehs in place of the vehicle.
+      for (size_t m = 0; m < n; ++m) {
+        size_t k = _batch_vehs[m];
+        if (k != std::numeric_limits<size_t>::max()) {
+          _batch_vehs[m] = vehs.at(k).destin;
+          serve_pax(k, pax[i + m]);
+        }
+      }
+      for (size_t m = 0; m < n; ++m) {
+        if (_batch_vehs[m] != std::numeric_limits<size_t>::max()) {
+          if (coalesce_events) {
+            _events_pending = true;
+          } else {
+            d.handle_pax_served(_batch_vehs[m]);
+          }
+        }
+      }
+    } else {
+      for (size_t m = i; m < j; ++m) {
+        handle_pax_with(pax[m], d);
+      }
+    }
+    i = j;
+  }
+}
+
+template <typename Dispatch>
+void BWSim::handle_pax_stream_with(size_t num_pax, BWPaxStream *pax_stream,
+    Dispatch &d) {
+  ASSERT(pax_stream);
+  if (!batch_pax) {
+    for (; num_pax > 0; --num_pax) {
+      handle_pax_with(pax_stream->next_pax(), d);
+    }
+    return;
+  }
+
+  // Collect the passengers that arrive at the same time, and handle them
+  // when the stream moves on to the next time (or ends).
+  _pax_batch.clear();
+  for (; num_pax > 0; --num_pax) {
+    BWPax pax = pax_stream->next_pax();
+    if (!_pax_batch.empty() && pax.arrive != _pax_batch.back().arrive) {
+      handle_pax_batch_with(&_pax_batch[0], _pax_batch.size(), d);
+      _pax_batch.clear();
+    }
+    _pax_batch.push_back(pax);
+  }
+  if (!_pax_batch.empty()) {
+    handle_pax_batch_with(&_pax_batch[0], _pax_batch.size(), d);
+  }
+}
+
+template <typename Dispatch>
+void BWSim::handle_idle_events(Dispatch &d) {
+  // This reproduces the scan in ascending order by vehicle index that the
+  // time stepping loop does: a vehicle that handle_idle makes idle at now is
+  // only handled if its index is higher than that of the current vehicle.
+  size_t last_k = SIZE_T_MAX;
+  while (!_calendar.empty() && _calendar.top().first == now) {
+    size_t k = _calendar.top().second;
+    _calendar.pop();
+    if (vehs[k].arrive == now && (last_k == SIZE_T_MAX || k > last_k)) {
+      last_k = k;
+      if (coalesce_events) {
+        _events_pending = true;
+      } else {
+        d.handle_idle(vehs[k]);
+      }
+    }
+  }
+}
+
+template <typename Dispatch>
+void BWSim::handle_end_of_step_events(Dispatch &d) {
+  if (strobe > 0 && now % strobe == 0) {
+    if (coalesce_events) {
+      _events_pending = true;
+    } else {
+      d.handle_strobe();
+    }
+  }
+
+  if (_events_pending) {
+    _events_pending = false;
+    d.handle_coalesced_events();
+  }
+}
+
+}
+
+#endif // guard
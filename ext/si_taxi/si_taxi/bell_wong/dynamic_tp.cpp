@@ -2,41 +2,145 @@
 #include <si_taxi/utility.h>
 #include "dynamic_tp.h"
 
-extern "C" {
-#include <si_taxi/relax4.h>
-}
-
 using namespace std;
 
 namespace si_taxi {
 
+void count_redistribution_surpluses(const BWSim &sim,
+    const std::vector<int> &targets, int *surpluses, int *idle) {
+  // This turns out to be a performance hotspot when the fleet size is large,
+  // so some clarity has been sacrificed for performance. The result is that
+  // for each station i, we set
+  //   surpluses[i] = min(
+  //     sim.num_vehicles_inbound(i) - targets[i],
+  //     sim.num_vehicles_idle_by(i, sim.now));
+  // which makes two passes over the vehicle array for each station. It seems
+  // to be much faster (total time reduced by 30%) to make a single pass over
+  // the vehicle array, count up the inbound and idle vehicles separately, and
+  // then combine them together. This requires temporary storage for the idle
+  // counts, but that's not so bad. If the sim keeps per-station indexes, the
+  // counts are available without scanning the vehicles at all.
+  ASSERT(targets.size() == sim.num_stations());
+  size_t num_stations = sim.num_stations();
+  if (sim.indexed) {
+    for (size_t i = 0; i < num_stations; ++i) {
+      surpluses[i] = sim.num_vehicles_inbound(i) - targets[i];
+      idle[i] = sim.num_vehicles_idle_by(i, sim.now);
+    }
+  } else {
+    for (size_t i = 0; i < num_stations; ++i) {
+      surpluses[i] = -targets[i];
+      idle[i] = 0;
+    }
+
+    size_t num_veh = sim.vehs.size();
+    for (size_t k = 0; k < num_veh; ++k) {
+      const BWVehicle &v_k = sim.vehs[k];
+      ++(surpluses[v_k.destin]);
+      if (v_k.arrive <= sim.now) {
+        ++(idle[v_k.destin]);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < num_stations; ++i) {
+    surpluses[i] = min(surpluses[i], idle[i]);
+  }
+}
+
 BWDynamicTransportationProblemHandler::BWDynamicTransportationProblemHandler(
-    BWSim &sim) : BWProactiveHandler(sim) {
+    BWSim &sim, size_t num_neighbours, MinCostFlowSolverType solver_type) :
+    BWProactiveHandler(sim), start_nodes(NULL), end_nodes(NULL), costs(NULL),
+    capacities(NULL), flows(NULL), solver(NULL), last_capacity(-1),
+    have_solution(false), _num_neighbours(num_neighbours), _num_arcs(0),
+    _solver_type(solver_type), warm_start(false), dump_problems_to(NULL),
+    cache_size(0), num_solves(0), num_solves_skipped(0), num_fallbacks(0),
+    num_cache_hits(0), num_cache_misses(0) {
   targets.resize(sim.num_stations(), 0);
+  last_demands.resize(num_nodes(), 0);
+
+  demands = new int[num_nodes()];
+  idle = new int[num_nodes()];      // temporary storage used in redistribute()
+  solver = new_min_cost_flow_solver(solver_type);
+
+  build_arcs(num_neighbours);
+}
+
+BWDynamicTransportationProblemHandler::
+	~BWDynamicTransportationProblemHandler() {
+  delete solver;
+  delete[] start_nodes;
+  delete[] end_nodes;
+  delete[] costs;
+  delete[] capacities;
+  delete[] demands;
+  delete[] idle;
+  delete[] flows;
+}
 
+void BWDynamicTransportationProblemHandler::build_arcs(size_t num_neighbours) {
+  // Choose the station-to-station arcs, ordered by start and then end station.
+  vector<pair<int, int> > station_arcs;
+  if (num_neighbours == 0 || num_neighbours + 1 >= (size_t)num_stations()) {
+    // Arcs from every station to every other station.
+    for (int i = 0; i < num_stations(); ++i) {
+      for (int j = 0; j < num_stations(); ++j) {
+        if (i != j) {
+          station_arcs.push_back(make_pair(i, j));
+        }
+      }
+    }
+  } else {
+    // Arcs to each station from its nearest upstream stations (ties broken by
+    // index) and from the previous station in the backbone ring.
+    vector<pair<int, int> > upstream; // (trip time, station)
+    for (int j = 0; j < num_stations(); ++j) {
+      upstream.clear();
+      for (int i = 0; i < num_stations(); ++i) {
+        if (i != j) {
+          upstream.push_back(make_pair(sim.trip_time(i, j), i));
+        }
+      }
+      partial_sort(upstream.begin(), upstream.begin() + num_neighbours,
+          upstream.end());
+
+      int ring_i = (j + num_stations() - 1) % num_stations();
+      bool have_ring_arc = false;
+      for (size_t n = 0; n < num_neighbours; ++n) {
+        station_arcs.push_back(make_pair(upstream[n].second, j));
+        have_ring_arc = have_ring_arc || upstream[n].second == ring_i;
+      }
+      if (!have_ring_arc) {
+        station_arcs.push_back(make_pair(ring_i, j));
+      }
+    }
+    sort(station_arcs.begin(), station_arcs.end());
+  }
+
+  delete[] start_nodes;
+  delete[] end_nodes;
+  delete[] costs;
+  delete[] capacities;
+  delete[] flows;
+
+  _num_arcs = station_arcs.size() + 2 * num_stations();
   start_nodes = new int[num_arcs()];
   end_nodes = new int[num_arcs()];
   costs = new int[num_arcs()];
   capacities = new int[num_arcs()];
-  demands = new int[num_nodes()];
-  idle = new int[num_nodes()];      // temporary storage used in redistribute()
   flows = new int[num_arcs()];
 
-  relax4_init(num_nodes(), num_arcs(),
-      start_nodes, end_nodes, costs, capacities,
-      demands, flows, RELAX4_DEFAULT_LARGE);
+  last_capacity = -1;
+  have_solution = false;
 
-  // Arcs from every station to every other station.
   size_t a = 0;
-  for (int i = 0; i < num_stations(); ++i) {
-    for (int j = 0; j < num_stations(); ++j) {
-      if (i != j) {
-        start_nodes[a] = i+1;
-        end_nodes[a] = j+1;
-        costs[a] = sim.trip_time(i, j);
-        ++a;
-      }
-    }
+  for (; a < station_arcs.size(); ++a) {
+    int i = station_arcs[a].first;
+    int j = station_arcs[a].second;
+    start_nodes[a] = i+1;
+    end_nodes[a] = j+1;
+    costs[a] = sim.trip_time(i, j);
+    flows[a] = 0;
   }
 
   // Arcs from source to every station.
@@ -44,6 +148,7 @@ BWDynamicTransportationProblemHandler::BWDynamicTransportationProblemHandler(
     start_nodes[a] = source_node();
     end_nodes[a] = i+1;
     costs[a] = 0;
+    flows[a] = 0;
     ++a;
   }
 
@@ -52,22 +157,14 @@ BWDynamicTransportationProblemHandler::BWDynamicTransportationProblemHandler(
     start_nodes[a] = i+1;
     end_nodes[a] = sink_node();
     costs[a] = 0;
+    flows[a] = 0;
     ++a;
   }
 
   CHECK(a == (size_t)num_arcs());
-}
 
-BWDynamicTransportationProblemHandler::
-	~BWDynamicTransportationProblemHandler() {
-  relax4_free();
-  delete[] start_nodes;
-  delete[] end_nodes;
-  delete[] costs;
-  delete[] capacities;
-  delete[] demands;
-  delete[] idle;
-  delete[] flows;
+  solver->init(num_nodes(), num_arcs(), start_nodes, end_nodes, costs,
+      capacities, demands, flows);
 }
 
 void BWDynamicTransportationProblemHandler::handle_pax_served(
@@ -85,34 +182,9 @@ void BWDynamicTransportationProblemHandler::handle_strobe() {
 
 void BWDynamicTransportationProblemHandler::redistribute() {
   ASSERT(targets.size() == sim.num_stations());
-  // This turns out to be a performance hotspot when the fleet size is large,
-  // so some clarity has been sacrificed for performance. The result is that
-  // for each station i, we set
-  //   demands[i] = -min(
-  //     sim.num_vehicles_inbound(i) - targets[i],
-  //     sim.num_vehicles_idle_by(i, sim.now));
-  // which makes two passes over the vehicle array for each station. It seems
-  // to be much faster (total time reduced by 30%) to make a single pass over
-  // the vehicle array, count up the inbound and idle vehicles separately, and
-  // then combine them together. This requires temporary storage for the idle
-  // counts, but that's not so bad.
-  size_t num_stations = sim.num_stations();
-  for (size_t i = 0; i < num_stations; ++i) {
-    demands[i] = -targets[i];
-    idle[i] = 0;
-  }
-
-  size_t num_veh = sim.vehs.size();
-  for (size_t k = 0; k < num_veh; ++k) {
-    BWVehicle &v_k = sim.vehs[k];
-    ++(demands[v_k.destin]);
-    if (v_k.arrive <= sim.now) {
-      ++(idle[v_k.destin]);
-    }
-  }
-
-  for (size_t i = 0; i < num_stations; ++i) {
-    demands[i] = -min(demands[i], idle[i]);
+  count_redistribution_surpluses(sim, targets, demands, idle);
+  for (int i = 0; i < num_stations(); ++i) {
+    demands[i] = -demands[i];
   }
 
   set_source_sink_demands();
@@ -156,46 +228,163 @@ void BWDynamicTransportationProblemHandler::solve() {
   // one time, the targets may be higher than the fleet size; it seems highly
   // unlikely that we'd ever set targets 100x higher. However, some test cases
   // have very small fleets and large demands.
+  int capacity = 100 * sim.vehs.size();
+
+  // The demands often don't change between calls (e.g. when a vehicle becomes
+  // idle at a station that already has a surplus). Then the last solution is
+  // still the solution; move_by_flows leaves it in flows. Note that relax4
+  // overwrites the demands while solving, so we have to keep our own copy.
+  if (have_solution && capacity == last_capacity &&
+      equal(demands, demands + num_nodes(), last_demands.begin())) {
+    ++num_solves_skipped;
+    return;
+  }
+  copy(demands, demands + num_nodes(), last_demands.begin());
+  if (capacity != last_capacity) {
+    // The cached solutions are for the old capacities (or the old arcs).
+    clear_cache();
+    last_capacity = capacity;
+  }
+  have_solution = false;
+
+  // Otherwise, we may have seen these demands before.
+  if (cache_size > 0) {
+    if (find_cached_flows()) {
+      ++num_cache_hits;
+      have_solution = true;
+      return;
+    }
+    ++num_cache_misses;
+  }
+  ++num_solves;
+
   for (int a = 0; a < num_arcs(); ++a) {
-    capacities[a] = 100 * sim.vehs.size();
+    capacities[a] = capacity;
   }
 
   //for (int i = 0; i < num_nodes(); ++i) TV(demands[i]);
 
+  if (dump_problems_to)
+    *dump_problems_to << dump_problem();
+
 #ifndef NDEBUG
   string temp = dump_problem();
 #endif
-  ASSERT(RELAX4_OK == relax4_check_inputs(RELAX4_DEFAULT_MAX_COST));
-  CHECK(RELAX4_OK == relax4_init_phase_1());
-  CHECK(RELAX4_OK == relax4_init_phase_2());
+  bool ok = solver->solve(warm_start);
+
+  if (!ok && sparse()) {
+    // The backbone arcs should make this impossible, but if it does happen,
+    // switch to the full arc set and solve again.
+    ++num_fallbacks;
+    build_arcs(0);
+    copy(last_demands.begin(), last_demands.end(), demands);
+    solve();
+    return;
+  }
 #ifndef NDEBUG
-  int result = relax4_run();
-  if (RELAX4_INFEASIBLE == result)
+  if (!ok)
     FAIL("infeasible:\n" << temp);
-  CHECK(RELAX4_OK == result);
-#else
-  CHECK(RELAX4_OK == relax4_run());
 #endif
-  ASSERT(RELAX4_OK == relax4_check_output());
+  CHECK(ok);
+  have_solution = true;
+  if (cache_size > 0)
+    cache_flows();
 
   //for (int a = 0; a < num_arcs(); ++a) TV(flows[a]);
 }
 
+void BWDynamicTransportationProblemHandler::clear_cache() {
+  cache.clear();
+  cache_index.clear();
+}
+
+bool BWDynamicTransportationProblemHandler::find_cached_flows() {
+  cache_index_t::iterator it = cache_index.find(last_demands);
+  if (it == cache_index.end())
+    return false;
+
+  // Move the entry to the front, so it is the most recently used.
+  cache.splice(cache.begin(), cache, it->second);
+
+  const cached_flows_t &cached_flows = it->second->second;
+  fill(flows, flows + num_arcs(), 0);
+  for (cached_flows_t::const_iterator fit = cached_flows.begin();
+      fit != cached_flows.end(); ++fit) {
+    flows[fit->first] = fit->second;
+  }
+  return true;
+}
+
+void BWDynamicTransportationProblemHandler::cache_flows() {
+  ASSERT(cache_index.find(last_demands) == cache_index.end());
+  cache.push_front(make_pair(last_demands, cached_flows_t()));
+  cached_flows_t &cached_flows = cache.front().second;
+  for (int a = 0; a < num_arcs(); ++a) {
+    if (flows[a] != 0)
+      cached_flows.push_back(make_pair(a, flows[a]));
+  }
+  cache_index[last_demands] = cache.begin();
+
+  while (cache.size() > cache_size) {
+    cache_index.erase(cache.back().first);
+    cache.pop_back();
+  }
+}
+
 void BWDynamicTransportationProblemHandler::move_by_flows() {
+  if (sparse()) {
+    move_by_paths();
+    return;
+  }
+
   // Check station-to-station flows for movements to make.
-  size_t a = 0;
+  for (int a = 0; a < num_station_arcs(); ++a) {
+    ASSERT(flows[a] >= 0);
+    int i = start_nodes[a] - 1;
+    int j = end_nodes[a] - 1;
+    for (int n = 0; n < flows[a]; ++n) {
+      ASSERT(sim.num_vehicles_idle_by(i, sim.now) > 0);
+      sim.move_empty_od(i, j);
+    }
+  }
+}
+
+void BWDynamicTransportationProblemHandler::move_by_paths() {
+  // Net outflow from each station, and the first arc out of each station (the
+  // station arcs are ordered by start station).
+  vector<int> net(num_stations(), 0);
+  vector<int> first_arc(num_stations() + 1, num_station_arcs());
+  for (int a = num_station_arcs() - 1; a >= 0; --a) {
+    ASSERT(flows[a] >= 0);
+    net[start_nodes[a] - 1] += flows[a];
+    net[end_nodes[a] - 1] -= flows[a];
+    first_arc[start_nodes[a] - 1] = a;
+  }
+  for (int i = num_stations() - 1; i >= 0; --i) {
+    first_arc[i] = min(first_arc[i], first_arc[i + 1]);
+  }
+
+  // Decompose the flows into paths from stations with net outflow to stations
+  // with net inflow, and move one vehicle along each path. Flow is conserved
+  // at the stations in between, so each path can always be extended.
+  vector<int> remaining(flows, flows + num_station_arcs());
   for (int i = 0; i < num_stations(); ++i) {
-    for (int j = 0; j < num_stations(); ++j) {
-      if (i != j) {
-        ASSERT(flows[a] >= 0);
-        ASSERT(a < (size_t)num_arcs());
-        while (flows[a] > 0) {
-          ASSERT(sim.num_vehicles_idle_by(i, sim.now) > 0);
-          sim.move_empty_od(i, j);
-          --(flows[a]);
+    while (net[i] > 0) {
+      int v = i;
+      do {
+        int a = first_arc[v];
+        while (remaining[a] == 0) {
+          ++a;
         }
-        ++a;
-      }
+        ASSERT(a < first_arc[v + 1]);
+        --remaining[a];
+        v = end_nodes[a] - 1;
+      } while (net[v] >= 0);
+
+      ASSERT(sim.num_vehicles_idle_by(i, sim.now) > 0);
+      sim.move_empty_od(i, v);
+      --net[i];
+      ++net[v];
     }
   }
 }
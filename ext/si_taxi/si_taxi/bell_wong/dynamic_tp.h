@@ -1,22 +1,52 @@
 #ifndef SI_TAXI_BELL_WONG_DTP_H_
 #define SI_TAXI_BELL_WONG_DTP_H_
 
+#include <list>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+
 #include "bell_wong.h"
+#include <si_taxi/min_cost_flow.h>
 
 namespace si_taxi {
 
+/**
+ * The surplus of vehicles at each station, for redistribution: the number of
+ * vehicles inbound to station i in excess of targets[i], but no more than the
+ * number of vehicles idle at i now. Negative values are deficits.
+ *
+ * @param surpluses output; one per station
+ * @param idle temporary storage for one int per station
+ */
+void count_redistribution_surpluses(const BWSim &sim,
+    const std::vector<int> &targets, int *surpluses, int *idle);
+
 /**
  * The Dynamic Transportation Problem (DTP) heuristic.
  *
- * Note that there is only one transportation problem solver instance, so you
- * must use at most one instance of BWDynamicTransportationProblemHandler at a
- * time.
+ * Each instance has its own transportation problem solver state, so several
+ * instances (e.g. in different sims or threads) can be used at the same time.
+ *
+ * By default, every station is linked to every other station, so the problem
+ * has O(N^2) arcs. For large networks, num_neighbours can be set to link each
+ * station only from its nearest stations. Vehicles may then be routed through
+ * other stations in the solution; they are moved directly from the start to
+ * the end of their routes.
  */
 struct BWDynamicTransportationProblemHandler : public BWProactiveHandler {
   /**
    * @param sim
+   * @param num_neighbours if zero (the default), there is an arc from every
+   * station to every other station; otherwise, there are arcs to each station
+   * only from the num_neighbours stations with the shortest trip times to it,
+   * plus backbone arcs that link the stations in a ring (in index order), so
+   * that the problem is always feasible
+   * @param solver_type the min cost flow solver to use; the default, relax4,
+   * is usually the fastest, but see test_8 in si_taxi_test
    */
-  BWDynamicTransportationProblemHandler(BWSim &sim);
+  BWDynamicTransportationProblemHandler(BWSim &sim,
+      size_t num_neighbours = 0,
+      MinCostFlowSolverType solver_type = MIN_COST_FLOW_RELAX4);
 
   /// Destructor.
   virtual ~BWDynamicTransportationProblemHandler();
@@ -45,8 +75,18 @@ struct BWDynamicTransportationProblemHandler : public BWProactiveHandler {
   inline int num_stations() const { return sim.num_stations(); }
   /// One node per station plus source and sink.
   inline int num_nodes() const { return num_stations() + 2; }
-  /// Every station links to every other station (N-1) + source and sink.
-  inline int num_arcs() const { return num_stations() * (num_stations() + 1); }
+  /// Station-to-station arcs (numbered first) + source and sink arcs.
+  inline int num_arcs() const { return _num_arcs; }
+  /// Station-to-station arcs; N(N-1) unless the arc set is sparse.
+  inline int num_station_arcs() const {
+    return num_arcs() - 2 * num_stations(); }
+  /// Whether some stations are not linked directly; see num_neighbours.
+  inline bool sparse() const {
+    return num_station_arcs() < num_stations() * (num_stations() - 1); }
+  /// See constructor.
+  inline size_t num_neighbours() const { return _num_neighbours; }
+  /// See constructor.
+  inline MinCostFlowSolverType solver_type() const { return _solver_type; }
   /// Source and sink are numbered after stations.
   inline int source_node() const { return num_stations() + 1; }
   /// Source and sink are numbered after stations.
@@ -54,11 +94,24 @@ struct BWDynamicTransportationProblemHandler : public BWProactiveHandler {
 
   /**
    * Get currently configured problem in format for the original relax4 solver.
+   * The capacities are those from the last solve.
    */
   std::string dump_problem();
 
+  /**
+   * Remove all solutions from the cache; see cache_size.
+   */
+  void clear_cache();
+
 protected:
 
+  /**
+   * (Re)allocate the problem arrays and solver state, and set up the arcs.
+   *
+   * @param num_neighbours see constructor
+   */
+  void build_arcs(size_t num_neighbours);
+
   /**
    * Set source and sink demand to balance out the given net_demand, which is
    * the sum of demands for all station nodes.
@@ -68,14 +121,38 @@ protected:
   /**
    * Solve the minimum cost flow problem; the demands (and costs, etc.) must
    * have been set up before this is called.
+   *
+   * If the demands and capacities are the same as for the last solve, the
+   * solution is the same, so the flows from the last solve are kept. If they
+   * are the same as for a solve in the cache (see cache_size), the flows are
+   * copied from the cache.
    */
   void solve();
 
   /**
-   * Move idle vehicles according to flows.
+   * Look up last_demands in the cache; if found, copy the cached flows into
+   * flows and return true.
+   */
+  bool find_cached_flows();
+
+  /**
+   * Add flows to the cache as the solution for last_demands, and evict the
+   * least recently used entries if the cache is full.
+   */
+  void cache_flows();
+
+  /**
+   * Move idle vehicles according to flows. The flows are not changed, so they
+   * can be reused by solve().
    */
   void move_by_flows();
 
+  /**
+   * Move idle vehicles according to flows in a sparse network, in which flows
+   * may pass through other stations; see move_by_flows.
+   */
+  void move_by_paths();
+
   int *start_nodes;
   int *end_nodes;
   int *costs;
@@ -84,11 +161,72 @@ protected:
   /// temporary storage used in redistribute()
   int *idle;
   int *flows;
-
+  /// solver for the problem above; it works on the arrays above in place
+  MinCostFlowSolver *solver;
+  /// demands (before solving) and capacity for the last solve; see solve()
+  std::vector<int> last_demands;
+  int last_capacity;
+  /// true if flows holds the solution for last_demands
+  bool have_solution;
+  size_t _num_neighbours;
+  int _num_arcs;
+  MinCostFlowSolverType _solver_type;
+
+  /// (arc, flow) pairs for the arcs with non-zero flow
+  typedef std::vector<std::pair<int, int> > cached_flows_t;
+  /// cached solutions, keyed by demands; most recently used first
+  typedef std::list<std::pair<std::vector<int>, cached_flows_t> > cache_t;
+  typedef boost::unordered_map<std::vector<int>, cache_t::iterator,
+      boost::hash<std::vector<int> > > cache_index_t;
+  cache_t cache;
+  cache_index_t cache_index;
 
 public:
   /// see redistribute(...)
   std::vector<int> targets;
+
+  /**
+   * If true, start each solve from the prices and flows of the previous solve,
+   * rather than from scratch; default false. This is much faster when only a
+   * few supplies have changed since the last solve, but when there are ties,
+   * it may choose a different optimal solution than a cold start would. Only
+   * the relax4 solver supports this; the others ignore it.
+   */
+  bool warm_start;
+
+  /**
+   * If not NULL, each problem is written here (see dump_problem) before it is
+   * solved; default NULL. This is for collecting instances to benchmark the
+   * solvers on (see test_8 in si_taxi_test).
+   */
+  std::ostream *dump_problems_to;
+
+  /**
+   * Maximum number of solutions to keep; default 0 (no cache). The solutions
+   * are keyed by the node demands (surpluses and deficits net of targets), and
+   * the least recently used one is evicted when the cache is full. When the
+   * same states recur often, as in long runs on small networks, most solves
+   * can be replaced by a lookup. Each entry takes O(N) space.
+   */
+  size_t cache_size;
+
+  /// number of calls to solve() that ran the solver
+  size_t num_solves;
+
+  /// number of calls to solve() that reused the last solution, because the
+  /// demands had not changed
+  size_t num_solves_skipped;
+
+  /// number of times that the sparse problem was infeasible, so the handler
+  /// switched to the full arc set; this should not happen
+  size_t num_fallbacks;
+
+  /// number of calls to solve() that copied the flows from the cache
+  size_t num_cache_hits;
+
+  /// number of calls to solve() that looked in the cache and had to run the
+  /// solver
+  size_t num_cache_misses;
 };
 
 }
@@ -0,0 +1,177 @@
+#include <si_taxi/stdafx.h>
+#include <si_taxi/utility.h>
+#include "replications.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+namespace si_taxi {
+
+BWReplication::BWReplication(size_t index) : index(index), stats(sim),
+    reactive(NULL), proactive(NULL), pax_stream(NULL) {
+  sim.stats = &stats;
+}
+
+BWReplication::~BWReplication() {
+  delete reactive;
+  delete proactive;
+  delete pax_stream;
+  for (size_t k = 0; k < other_pax_streams.size(); ++k) {
+    delete other_pax_streams[k];
+  }
+}
+
+/**
+ * Add histogram b to histogram a.
+ */
+static void merge_histogram(NaturalHistogram &a, const NaturalHistogram &b) {
+  if (a.frequency.size() < b.frequency.size())
+    a.frequency.resize(b.frequency.size(), 0);
+  for (size_t x = 0; x < b.frequency.size(); ++x) {
+    a.frequency[x] += b.frequency[x];
+  }
+}
+
+static void merge_histograms(vector<NaturalHistogram> &a,
+    const vector<NaturalHistogram> &b) {
+  if (a.size() < b.size())
+    a.resize(b.size());
+  for (size_t i = 0; i < b.size(); ++i) {
+    merge_histogram(a[i], b[i]);
+  }
+}
+
+static void merge_counts(boost::numeric::ublas::matrix<size_t> &a,
+    const boost::numeric::ublas::matrix<size_t> &b) {
+  if (a.size1() == 0) {
+    a = b;
+  } else {
+    CHECK(a.size1() == b.size1() && a.size2() == b.size2());
+    a += b;
+  }
+}
+
+void BWReplicationStats::merge(const BWSimStatsDetailed &stats) {
+  merge_histograms(pax_wait, stats.pax_wait);
+  merge_histograms(queue_len, stats.queue_len);
+  merge_histograms(idle_vehs, stats.idle_vehs);
+  merge_histogram(idle_vehs_total, stats.idle_vehs_total);
+  merge_counts(occupied_trips, stats.occupied_trips);
+  merge_counts(empty_trips, stats.empty_trips);
+}
+
+void BWReplicationStats::merge(const BWReplicationStats &other) {
+  merge_histograms(pax_wait, other.pax_wait);
+  merge_histograms(queue_len, other.queue_len);
+  merge_histograms(idle_vehs, other.idle_vehs);
+  merge_histogram(idle_vehs_total, other.idle_vehs_total);
+  if (other.occupied_trips.size1() > 0)
+    merge_counts(occupied_trips, other.occupied_trips);
+  if (other.empty_trips.size1() > 0)
+    merge_counts(empty_trips, other.empty_trips);
+}
+
+BWReplicationRunner::BWReplicationRunner(BWScenario &scenario) :
+    scenario(scenario), num_replications(1), num_pax(0), num_threads(1),
+    seed(5489), _next(0) { }
+
+BWReplicationStats BWReplicationRunner::run() {
+  CHECK(num_threads > 0);
+  _next = 0;
+  _rng.seed(seed);
+  _mean_pax_wait.assign(num_replications,
+      numeric_limits<double>::quiet_NaN());
+  _error.clear();
+
+  size_t num_workers = min(num_threads, max(num_replications, (size_t)1));
+  vector<BWReplicationStats> partials(num_workers);
+  boost::thread_group threads;
+  for (size_t t = 1; t < num_workers; ++t) {
+    threads.create_thread(boost::bind(&BWReplicationRunner::run_worker, this,
+        boost::ref(partials[t])));
+  }
+  run_worker(partials[0]);
+  threads.join_all();
+
+  if (!_error.empty())
+    FAIL("replication failed: " << _error);
+
+  // The counts are integers, so the merge order does not matter.
+  BWReplicationStats stats;
+  for (size_t t = 0; t < num_workers; ++t) {
+    stats.merge(partials[t]);
+  }
+  stats.mean_pax_wait = _mean_pax_wait;
+  return stats;
+}
+
+void BWReplicationRunner::run_worker(BWReplicationStats &partial) {
+  for (;;) {
+    BWReplication *rep = NULL;
+    try {
+      rep = next_replication();
+      if (!rep)
+        return;
+
+      rep->sim.reactive = rep->reactive;
+      rep->sim.proactive = rep->proactive;
+      rep->sim.init();
+      scenario.start(*rep);
+      rep->sim.handle_pax_stream(num_pax, rep->pax_stream);
+
+      partial.merge(rep->stats);
+      uint64_t count = 0;
+      double total = 0;
+      for (size_t i = 0; i < rep->stats.pax_wait.size(); ++i) {
+        const vector<size_t> &f = rep->stats.pax_wait[i].frequency;
+        for (size_t x = 0; x < f.size(); ++x) {
+          count += f[x];
+          total += (double)x * f[x];
+        }
+      }
+      if (count > 0)
+        _mean_pax_wait[rep->index] = total / count;
+    } catch (const std::exception &e) {
+      boost::mutex::scoped_lock lock(_mutex);
+      if (_error.empty())
+        _error = e.what();
+      _next = num_replications; // stop the other workers
+    }
+    delete rep;
+  }
+}
+
+BWReplication *BWReplicationRunner::next_replication() {
+  boost::mutex::scoped_lock lock(_mutex);
+  if (_next >= num_replications)
+    return NULL;
+
+  BWReplication *rep = new BWReplication(_next);
+  try {
+    scenario.build(*rep);
+    CHECK(rep->reactive);
+    CHECK(rep->proactive);
+    CHECK(rep->pax_stream);
+  } catch (...) {
+    delete rep;
+    throw;
+  }
+
+  // Substream j of replication i is i long jumps and j jumps from the seed.
+  RNG stream_rng(_rng);
+  rep->sim.rng.seed(stream_rng);
+  stream_rng.jump();
+  rep->pax_stream->rng.seed(stream_rng);
+  for (size_t k = 0; k < rep->other_pax_streams.size(); ++k) {
+    stream_rng.jump();
+    rep->other_pax_streams[k]->rng.seed(stream_rng);
+  }
+
+  ++_next;
+  _rng.long_jump();
+  return rep;
+}
+
+}
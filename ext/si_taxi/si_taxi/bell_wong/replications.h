@@ -0,0 +1,166 @@
+#ifndef SI_TAXI_BELL_WONG_REPLICATIONS_H_
+#define SI_TAXI_BELL_WONG_REPLICATIONS_H_
+
+#include "bell_wong.h"
+
+#include <boost/thread/mutex.hpp>
+
+namespace si_taxi {
+
+/**
+ * The sim, handlers, passenger streams and statistics for one replication
+ * run by BWReplicationRunner. The replication owns (and deletes) the
+ * handlers and streams; the scenario creates them with new.
+ */
+struct BWReplication {
+  BWReplication(size_t index);
+  ~BWReplication();
+
+  /// replications are numbered from 0
+  size_t index;
+
+  /// the sim; stats is set to the stats member
+  BWSim sim;
+
+  /// statistics for this replication; set by the constructor
+  BWSimStatsDetailed stats;
+
+  /// set by the scenario; also assigned to sim.reactive by the runner
+  BWReactiveHandler *reactive;
+
+  /// set by the scenario; also assigned to sim.proactive by the runner
+  BWProactiveHandler *proactive;
+
+  /// set by the scenario; the requests to run
+  BWPaxStream *pax_stream;
+
+  /**
+   * Any other streams the handlers use (e.g. the pax_stream of a
+   * BWSamplingVotingHandler); these are seeded and deleted with pax_stream.
+   */
+  std::vector<BWPaxStream *> other_pax_streams;
+
+private:
+  // the handlers refer to sim, so a replication can't be copied
+  BWReplication(const BWReplication &);
+  BWReplication &operator=(const BWReplication &);
+};
+
+/**
+ * Creates the sim, handlers and streams for each replication; see
+ * BWReplicationRunner.
+ */
+struct BWScenario {
+  virtual ~BWScenario() { }
+
+  /**
+   * Set up the given (new) replication: set the trip times, add the vehicles
+   * and create the handlers and streams. This is called from the worker
+   * threads, but only one at a time, and in order by replication index.
+   * The random streams are seeded after this, so it should not draw random
+   * numbers; see start.
+   */
+  virtual void build(BWReplication &rep) = 0;
+
+  /**
+   * Finish setting up the given replication after its streams have been
+   * seeded and sim.init has been called, just before its requests are run;
+   * e.g. to set random targets for a proactive handler. Random numbers must be
+   * drawn from rep.sim.rng. This may be called from several worker threads at
+   * once, so it should only change rep. The default does nothing.
+   */
+  virtual void start(BWReplication &/*rep*/) { }
+};
+
+/**
+ * Statistics merged over replications.
+ */
+struct BWReplicationStats {
+  /// merged BWSimStatsDetailed::pax_wait histograms
+  std::vector<NaturalHistogram> pax_wait;
+  /// merged BWSimStatsDetailed::queue_len histograms
+  std::vector<NaturalHistogram> queue_len;
+  /// merged BWSimStatsDetailed::idle_vehs histograms
+  std::vector<NaturalHistogram> idle_vehs;
+  /// merged BWSimStatsDetailed::idle_vehs_total histogram
+  NaturalHistogram idle_vehs_total;
+  /// total occupied trips between each pair of stations
+  boost::numeric::ublas::matrix<size_t> occupied_trips;
+  /// total empty trips between each pair of stations
+  boost::numeric::ublas::matrix<size_t> empty_trips;
+  /// mean passenger waiting time in each replication, in seconds; NaN for
+  /// a replication that served no passengers
+  std::vector<double> mean_pax_wait;
+
+  /**
+   * Add the given replication's statistics; this does not set mean_pax_wait.
+   */
+  void merge(const BWSimStatsDetailed &stats);
+
+  /**
+   * Add statistics merged from other replications; this does not set
+   * mean_pax_wait.
+   */
+  void merge(const BWReplicationStats &other);
+};
+
+/**
+ * Run independent replications of a scenario in parallel.
+ *
+ * Each replication has its own sim, handlers, streams and statistics, made
+ * by the scenario. The random streams for replication i are substreams of
+ * seed (see RNGStream): sim.rng is substream (i, 0), pax_stream's is (i, 1)
+ * and other_pax_streams[k]'s is (i, 2 + k). The results therefore depend
+ * only on the scenario and seed, not on num_threads or thread scheduling.
+ *
+ * The handlers must not use the Ruby interpreter (e.g. through a director)
+ * when num_threads is more than one.
+ */
+struct BWReplicationRunner {
+  /**
+   * @param scenario not owned; must live until run returns
+   */
+  BWReplicationRunner(BWScenario &scenario);
+
+  /**
+   * Run num_replications replications with num_pax requests each.
+   */
+  BWReplicationStats run();
+
+  /// see constructor
+  BWScenario &scenario;
+
+  /// number of replications to run; default 1
+  size_t num_replications;
+
+  /// number of requests to run in each replication; default 0
+  size_t num_pax;
+
+  /// number of worker threads (including the calling thread); default 1
+  size_t num_threads;
+
+  /// seed for the random streams; default 5489 (as for RNG)
+  RNG::result_type seed;
+
+protected:
+  /// Run replications until there are none left; partial is for this thread.
+  void run_worker(BWReplicationStats &partial);
+
+  /// Build and seed the next replication; NULL if there are none left.
+  BWReplication *next_replication();
+
+  /// guards next_replication
+  boost::mutex _mutex;
+  /// index of the next replication to build
+  size_t _next;
+  /// base generator for replication _next
+  RNG _rng;
+  /// see run; storage for the results from the workers
+  std::vector<double> _mean_pax_wait;
+  /// message from the first exception thrown by a worker, if any
+  std::string _error;
+};
+
+}
+
+#endif // guard
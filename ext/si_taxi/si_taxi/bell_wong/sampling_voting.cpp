@@ -2,13 +2,221 @@
 #include <si_taxi/utility.h>
 #include "sampling_voting.h"
 
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread.hpp>
+
 using namespace std;
 
 namespace si_taxi {
 
+/**
+ * Worker threads for BWSamplingVotingHandler::sample_in_threads. Each batch
+ * is published under the mutex with a new generation number; the workers
+ * wait on work_ready for a generation that they have not yet done, and the
+ * last one to finish signals work_done.
+ */
+struct BWSVWorkers {
+  BWSVWorkers() : generation(0), num_busy(0), stopping(false),
+    idle_vehs(NULL), num_stations_with_idle_vehs(0), begin(0), end(0) { }
+
+  boost::mutex mutex;
+  boost::condition_variable work_ready;
+  boost::condition_variable work_done;
+  boost::thread_group threads;
+
+  /// incremented for each batch
+  size_t generation;
+  /// number of workers that have not yet finished the current batch
+  size_t num_busy;
+  /// set to make the workers exit
+  bool stopping;
+
+  /// the current batch; see BWSamplingVotingHandler::sample_thread_sequences
+  const std::vector<int> *idle_vehs;
+  int num_stations_with_idle_vehs;
+  size_t begin;
+  size_t end;
+};
+
+void BWSVRollout::init(const BWSim &sim) {
+  num_stations = sim.num_stations();
+  now = sim.now;
+
+  trip_time_to.resize(num_stations * num_stations);
+  for (size_t j = 0; j < num_stations; ++j) {
+    for (size_t i = 0; i < num_stations; ++i) {
+      trip_time_to[j * num_stations + i] = sim.trip_time(i, j);
+    }
+  }
+
+  size_t num_veh = sim.vehs.size();
+  init_destin.resize(num_veh);
+  init_arrive.resize(num_veh);
+  for (size_t k = 0; k < num_veh; ++k) {
+    CHECK(sim.vehs[k].destin <= (size_t)numeric_limits<int>::max());
+    init_destin[k] = (int)sim.vehs[k].destin;
+    init_arrive[k] = max(sim.vehs[k].arrive, now);
+  }
+  destin.resize(num_veh);
+  arrive.resize(num_veh);
+
+  num_trivial_idle_trips.resize(num_stations);
+  first_idle_nt_destins.resize(num_stations);
+  first_destins.resize(num_stations);
+}
+
+void BWSVRollout::start(int num_stations_with_idle_vehs) {
+  ASSERT(init_arrive.size() > 0);
+  copy(init_destin.begin(), init_destin.end(), destin.begin());
+  copy(init_arrive.begin(), init_arrive.end(), arrive.begin());
+
+  this->num_stations_with_idle_vehs = num_stations_with_idle_vehs;
+  first_idle_nt_destins_done = 0;
+  fill(first_idle_nt_destins.begin(), first_idle_nt_destins.end(),
+      SIZE_T_MAX);
+  fill(num_trivial_idle_trips.begin(), num_trivial_idle_trips.end(), 0);
+  fill(first_destins.begin(), first_destins.end(), SIZE_T_MAX);
+}
+
+inline bool BWSVRollout::serve(const BWPax &pax) {
+  ASSERT(pax.origin < num_stations && pax.destin < num_stations);
+  size_t num_veh = arrive.size();
+  int *veh_destin = &destin[0];
+  BWTime *veh_arrive = &arrive[0];
+  const int *empty = &trip_time_to[pax.origin * num_stations];
+
+  // Choose a vehicle as in BWSNNHandler::choose_veh.
+  size_t ks = 0;
+  int ks_empty = empty[veh_destin[0]];
+  BWTime ks_arrive = veh_arrive[0] + ks_empty;
+  BWTime ks_wait = max((BWTime)0, ks_arrive - pax.arrive);
+  for (size_t k = 1; k < num_veh; ++k) {
+    int k_empty = empty[veh_destin[k]];
+    BWTime k_arrive = veh_arrive[k] + k_empty;
+    BWTime k_wait = max((BWTime)0, k_arrive - pax.arrive);
+    bool new_ks = k_wait < ks_wait || (
+        k_wait   == ks_wait   && (k_empty  < ks_empty || (
+        k_empty  == ks_empty  && (k_arrive > ks_arrive))));
+    if (new_ks) {
+      ks = k;
+      ks_empty = k_empty;
+      ks_arrive = k_arrive;
+      ks_wait = k_wait;
+    }
+  }
+  size_t k_origin = veh_destin[ks];
+
+  // Extracting solution features.
+  bool idle = (veh_arrive[ks] <= now);
+  bool nontrivial = (k_origin != pax.origin);
+  if (idle && nontrivial) {
+    if (first_idle_nt_destins[k_origin] == SIZE_T_MAX) {
+      first_idle_nt_destins[k_origin] = pax.origin;
+
+      // Can stop early if we get all of these done.
+      ++first_idle_nt_destins_done;
+      if (first_idle_nt_destins_done >= num_stations_with_idle_vehs) {
+        return true;
+      }
+    }
+  } else if (idle) {
+    ++num_trivial_idle_trips[k_origin]; // idle but trivial
+  } else if (nontrivial) {
+    if (first_destins[k_origin] == SIZE_T_MAX) {
+      first_destins[k_origin] = pax.origin;
+    }
+  }
+
+  // Update the vehicle as in BWSNNHandler::update_veh.
+  BWTime pickup = max(ks_arrive, pax.arrive);
+  veh_arrive[ks] = pickup +
+      trip_time_to[pax.destin * num_stations + pax.origin];
+  veh_destin[ks] = (int)pax.destin;
+  return false;
+}
+
+void BWSVRollout::vote(const std::vector<int> &idle_vehs,
+    ODHistogram &action_hist) const {
+  ASSERT(idle_vehs.size() == num_stations);
+  ASSERT(action_hist.num_stations() == num_stations);
+  for (size_t i = 0; i < num_stations; ++i) {
+    if (idle_vehs[i] == 0) {
+      // nothing to do
+    } else if (first_idle_nt_destins[i] != SIZE_T_MAX) {
+      action_hist.increment(i, first_idle_nt_destins[i]);
+    } else if (num_trivial_idle_trips[i] >= idle_vehs[i]) {
+      ASSERT(num_trivial_idle_trips[i] == idle_vehs[i]);
+      action_hist.increment(i, i);
+    } else if (first_destins[i] != SIZE_T_MAX) {
+      action_hist.increment(i, first_destins[i]);
+    } else {
+      action_hist.increment(i, i); // give up: leave vehicle where it is
+    }
+  }
+}
+
+void BWSVRollout::run(const std::vector<int> &idle_vehs,
+    int num_stations_with_idle_vehs, size_t num_pax, BWPaxStream &stream,
+    ODHistogram &action_hist) {
+  start(num_stations_with_idle_vehs);
+  stream.reset(now);
+  for (size_t p = 0; p < num_pax; ++p) {
+    if (serve(stream.next_pax()))
+      break;
+  }
+  vote(idle_vehs, action_hist);
+}
+
+void BWSVRollout::run(const std::vector<int> &idle_vehs,
+    int num_stations_with_idle_vehs, size_t num_pax, const BWPax *pax,
+    ODHistogram &action_hist) {
+  start(num_stations_with_idle_vehs);
+  for (size_t p = 0; p < num_pax; ++p) {
+    BWPax pax_p = pax[p];
+    pax_p.arrive += now;
+    if (serve(pax_p))
+      break;
+  }
+  vote(idle_vehs, action_hist);
+}
+
 BWSamplingVotingHandler::BWSamplingVotingHandler(BWSim &sim,
     BWPaxStream *pax_stream) : BWProactiveHandler(sim), pax_stream(pax_stream),
-    num_sequences(0), num_pax(0) {
+    num_sequences(0), num_pax(0), adaptive_sequences(false), min_sequences(5),
+    vote_z(2), max_decision_seconds(0), use_scenario_pool(false),
+    scenario_pool_refresh(0), num_scenario_pool_refreshes(0), num_decisions(0),
+    num_sequences_used(0), last_num_sequences_used(0), num_decided_early(0),
+    num_deadline_stops(0), last_decision_seconds(0),
+    max_observed_decision_seconds(0), total_decision_seconds(0), num_threads(1),
+    action_hist_buffer(sim.num_stations()), scenario_pool_num_sequences(0),
+    scenario_pool_num_pax(0), scenario_pool_age(0), workers(NULL) {
+}
+
+BWSamplingVotingHandler::~BWSamplingVotingHandler() {
+  clear_thread_streams();
+}
+
+void BWSamplingVotingHandler::clear_thread_streams() {
+  if (workers) {
+    {
+      boost::lock_guard<boost::mutex> lock(workers->mutex);
+      workers->stopping = true;
+    }
+    workers->work_ready.notify_all();
+    workers->threads.join_all();
+    delete workers;
+    workers = NULL;
+  }
+
+  for (size_t t = 0; t < thread_pax_streams.size(); ++t) {
+    delete thread_pax_streams[t];
+  }
+  thread_pax_streams.clear();
+}
+
+void BWSamplingVotingHandler::clear_scenario_pool() {
+  scenario_pool.clear();
 }
 
 void BWSamplingVotingHandler::handle_pax_served(
@@ -18,26 +226,27 @@ void BWSamplingVotingHandler::handle_pax_served(
 
 void BWSamplingVotingHandler::handle_idle(BWVehicle &veh) {
   // Run for only the station where the vehicle became idle.
-  vector<int> idle_vehs(sim.num_stations(), 0);
-  ODHistogram action_hist(sim.num_stations());
-  idle_vehs[veh.destin] = sim.num_vehicles_idle_by(veh.destin, sim.now);
-  //TV(sim.now);
-  //TV(idle_vehs);
-  sample(idle_vehs, action_hist);
-  //TV(action_hist);
-  move_to_best_destin_for_each_station(idle_vehs, action_hist);
+  idle_vehs_buffer.assign(sim.num_stations(), 0);
+  idle_vehs_buffer[veh.destin] = sim.num_vehicles_idle_by(veh.destin, sim.now);
+  sample_and_move();
 }
 
 void BWSamplingVotingHandler::handle_strobe() {
   // Run for all stations.
-  vector<int> idle_vehs(sim.num_stations(), 0);
-  ODHistogram action_hist(sim.num_stations());
-  sim.count_idle_vehs(idle_vehs);
+  idle_vehs_buffer.assign(sim.num_stations(), 0);
+  sim.count_idle_vehs(idle_vehs_buffer);
+  sample_and_move();
+}
+
+void BWSamplingVotingHandler::sample_and_move() {
+  if (action_hist_buffer.num_stations() != sim.num_stations()) {
+    action_hist_buffer = ODHistogram(sim.num_stations());
+  }
   //TV(sim.now);
-  //TV(idle_vehs);
-  sample(idle_vehs, action_hist);
-  //TV(action_hist);
-  move_to_best_destin_for_each_station(idle_vehs, action_hist);
+  //TV(idle_vehs_buffer);
+  sample(idle_vehs_buffer, action_hist_buffer);
+  //TV(action_hist_buffer);
+  move_to_best_destin_for_each_station(idle_vehs_buffer, action_hist_buffer);
 }
 
 void BWSamplingVotingHandler::clone_sim_vehs(
@@ -52,12 +261,6 @@ void BWSamplingVotingHandler::clone_sim_vehs(
 
 void BWSamplingVotingHandler::sample(const std::vector<int> &idle_vehs,
     ODHistogram &action_hist) {
-  vector<BWVehicle> clone_vehs;
-
-  vector<int> num_trivial_idle_trips(sim.num_stations());
-  vector<size_t> first_idle_nt_destins(sim.num_stations()); // nt = nontrivial
-  vector<size_t> first_destins(sim.num_stations());
-
   action_hist.clear();
 
   // Can stop early if we have assigned destinations for all stations with
@@ -77,68 +280,256 @@ void BWSamplingVotingHandler::sample(const std::vector<int> &idle_vehs,
   if (num_idle_vehs == 0)
     return;
 
-  for (size_t s = 0; s < num_sequences; ++s) {
-    // Copy system state.
-    clone_sim_vehs(BYREF clone_vehs);
+  using namespace boost::posix_time;
+  ptime start = microsec_clock::universal_time();
 
-    int first_idle_nt_destins_done = 0;
-    first_idle_nt_destins.assign(first_idle_nt_destins.size(), SIZE_T_MAX);
-    num_trivial_idle_trips.assign(num_trivial_idle_trips.size(), 0);
-    first_destins.assign(first_destins.size(), SIZE_T_MAX);
+  if (use_scenario_pool) {
+    update_scenario_pool();
+  }
 
-    // Generate sample and process.
-    pax_stream->reset(sim.now);
-    for (size_t p = 0; p < num_pax; ++p) {
-      BWPax pax = pax_stream->next_pax();
-      //TRACE("pax" << pax.origin << "-" << pax.destin << "@" << pax.arrive);
-      size_t k_star = BWSNNHandler::choose_veh(pax, clone_vehs, sim.trip_time);
-      //TV(k_star);
-      size_t k_origin = clone_vehs.at(k_star).destin;
-
-      // Extracting solution features.
-      bool idle = (clone_vehs[k_star].arrive <= sim.now);
-      bool nontrivial = (k_origin != pax.origin);
-      if (idle && nontrivial) {
-        if (first_idle_nt_destins[k_origin] == SIZE_T_MAX) {
-          first_idle_nt_destins[k_origin] = pax.origin;
-
-          // Can stop early if we get all of these done.
-          ++first_idle_nt_destins_done;
-          if (first_idle_nt_destins_done >= num_stations_with_idle_vehs) {
-            break;
-          }
-        }
-      } else if (idle) {
-        ++num_trivial_idle_trips[k_origin]; // idle but trivial
-      } else if (nontrivial) {
-        if (first_destins[k_origin] == SIZE_T_MAX) {
-          first_destins[k_origin] = pax.origin;
-        }
+  bool threaded = num_threads > 1 && num_sequences > 1 &&
+      init_thread_streams();
+
+  rollout.init(sim);
+  if (threaded) {
+    // Seed each sequence in order, so the results don't depend on which thread
+    // generates it.
+    if (!use_scenario_pool) {
+      seeds.resize(num_sequences);
+      for (size_t s = 0; s < num_sequences; ++s) {
+        seeds[s] = sim.rng.get()();
+      }
+    }
+
+    thread_rollouts.resize(num_threads);
+    for (size_t t = 0; t < num_threads; ++t) {
+      thread_rollouts[t] = rollout;
+    }
+  }
+
+  // Unless we may stop early, generate all of the sequences in one batch.
+  bool may_stop = adaptive_sequences || max_decision_seconds > 0;
+  size_t batch_size = !may_stop ? num_sequences : threaded ? num_threads : 1;
+
+  size_t num_done = 0;
+  while (num_done < num_sequences) {
+    size_t end = min(num_done + batch_size, num_sequences);
+    if (threaded) {
+      sample_in_threads(idle_vehs, num_stations_with_idle_vehs, num_done, end,
+          action_hist);
+    } else {
+      for (size_t s = num_done; s < end; ++s) {
+        sample_sequence(idle_vehs, num_stations_with_idle_vehs, s, rollout,
+            *pax_stream, action_hist);
+      }
+    }
+    num_done = end;
+    if (num_done >= num_sequences)
+      break;
+
+    if (adaptive_sequences && num_done >= min_sequences &&
+        votes_decided(idle_vehs, action_hist, num_done)) {
+      ++num_decided_early;
+      break;
+    }
+    if (max_decision_seconds > 0 && (microsec_clock::universal_time() -
+        start).total_microseconds() >= 1e6 * max_decision_seconds) {
+      ++num_deadline_stops;
+      break;
+    }
+  }
+
+  ++num_decisions;
+  last_num_sequences_used = num_done;
+  num_sequences_used += num_done;
+  last_decision_seconds =
+      (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+  total_decision_seconds += last_decision_seconds;
+  max_observed_decision_seconds =
+      max(max_observed_decision_seconds, last_decision_seconds);
+}
+
+bool BWSamplingVotingHandler::votes_decided(const std::vector<int> &idle_vehs,
+    const ODHistogram &action_hist, size_t num_done) const {
+  ASSERT(num_done <= num_sequences);
+  size_t num_remaining = num_sequences - num_done;
+  for (size_t i = 0; i < action_hist.num_stations(); ++i) {
+    if (idle_vehs[i] == 0)
+      continue;
+
+    // Votes for the leading destination and the runner-up.
+    int a = 0, b = 0;
+    for (size_t j = 0; j < action_hist.num_stations(); ++j) {
+      int votes = action_hist(i, j);
+      if (votes > a) {
+        b = a;
+        a = votes;
+      } else if (votes > b) {
+        b = votes;
+      }
+    }
+
+    if (a - b > (int)num_remaining)
+      continue; // the runner-up can't catch up
+    if (a - b > 0 && a - b >= vote_z * sqrt((double)(a + b)))
+      continue;
+    return false;
+  }
+  return true;
+}
+
+bool BWSamplingVotingHandler::init_thread_streams() {
+  if (workers && workers->threads.size() != num_threads - 1) {
+    clear_thread_streams(); // num_threads has changed
+  }
+
+  // The threads don't need their own streams if they use the pool.
+  if (!use_scenario_pool && thread_pax_streams.size() != num_threads) {
+    clear_thread_streams();
+    thread_rngs.resize(num_threads);
+    for (size_t t = 0; t < num_threads; ++t) {
+      BWPaxStream *stream = pax_stream->clone(thread_rngs[t]);
+      if (!stream) {
+        clear_thread_streams();
+        return false;
       }
+      thread_pax_streams.push_back(stream);
+    }
+  }
 
-      BWSNNHandler::update_veh(pax, clone_vehs[k_star], sim.trip_time);
+  if (!workers) {
+    workers = new BWSVWorkers();
+    for (size_t t = 1; t < num_threads; ++t) {
+      workers->threads.create_thread(
+          boost::bind(&BWSamplingVotingHandler::run_worker, this, t));
     }
+  }
+  return true;
+}
 
-    //TV(first_idle_nt_destins);
-    //TV(num_trivial_idle_trips);
-    //TV(first_destins);
+void BWSamplingVotingHandler::sample_in_threads(
+    const std::vector<int> &idle_vehs, int num_stations_with_idle_vehs,
+    size_t begin, size_t end, ODHistogram &action_hist) {
+  if (thread_hists.size() != num_threads ||
+      thread_hists[0].num_stations() != sim.num_stations()) {
+    thread_hists.assign(num_threads, ODHistogram(sim.num_stations()));
+  }
+  for (size_t t = 0; t < num_threads; ++t) {
+    thread_hists[t].clear();
+  }
 
-    // Accumulate decisions in action_hist.
+  ASSERT(workers && workers->threads.size() == num_threads - 1);
+  {
+    boost::lock_guard<boost::mutex> lock(workers->mutex);
+    workers->idle_vehs = &idle_vehs;
+    workers->num_stations_with_idle_vehs = num_stations_with_idle_vehs;
+    workers->begin = begin;
+    workers->end = end;
+    workers->num_busy = num_threads - 1;
+    ++workers->generation;
+  }
+  workers->work_ready.notify_all();
+
+  sample_thread_sequences(idle_vehs, num_stations_with_idle_vehs, begin, end,
+      0);
+
+  {
+    boost::unique_lock<boost::mutex> lock(workers->mutex);
+    while (workers->num_busy > 0) {
+      workers->work_done.wait(lock);
+    }
+  }
+
+  for (size_t t = 0; t < num_threads; ++t) {
     for (size_t i = 0; i < sim.num_stations(); ++i) {
-      if (idle_vehs[i] == 0) {
-        // nothing to do
-      } else if (first_idle_nt_destins[i] != SIZE_T_MAX) {
-        action_hist.increment(i, first_idle_nt_destins[i]);
-      } else if (num_trivial_idle_trips[i] >= idle_vehs[i]) {
-        ASSERT(num_trivial_idle_trips[i] == idle_vehs[i]);
-        action_hist.increment(i, i);
-      } else if (first_destins[i] != SIZE_T_MAX) {
-        action_hist.increment(i, first_destins[i]);
-      } else {
-        action_hist.increment(i, i); // give up: leave vehicle where it is
+      for (size_t j = 0; j < sim.num_stations(); ++j) {
+        action_hist.accumulate(i, j, thread_hists[t](i, j));
+      }
+    }
+  }
+}
+
+void BWSamplingVotingHandler::run_worker(size_t thread) {
+  size_t done = 0;
+  for (;;) {
+    const std::vector<int> *idle_vehs;
+    int num_stations_with_idle_vehs;
+    size_t begin, end;
+    {
+      boost::unique_lock<boost::mutex> lock(workers->mutex);
+      while (!workers->stopping && workers->generation == done) {
+        workers->work_ready.wait(lock);
       }
+      if (workers->stopping)
+        return;
+      done = workers->generation;
+      idle_vehs = workers->idle_vehs;
+      num_stations_with_idle_vehs = workers->num_stations_with_idle_vehs;
+      begin = workers->begin;
+      end = workers->end;
+    }
+
+    sample_thread_sequences(*idle_vehs, num_stations_with_idle_vehs, begin,
+        end, thread);
+
+    boost::lock_guard<boost::mutex> lock(workers->mutex);
+    if (--workers->num_busy == 0) {
+      workers->work_done.notify_one();
+    }
+  }
+}
+
+void BWSamplingVotingHandler::sample_thread_sequences(
+    const std::vector<int> &idle_vehs, int num_stations_with_idle_vehs,
+    size_t begin, size_t end, size_t thread) {
+  for (size_t s = begin + thread; s < end; s += num_threads) {
+    if (use_scenario_pool) {
+      sample_sequence(idle_vehs, num_stations_with_idle_vehs, s,
+          thread_rollouts[thread], *pax_stream, thread_hists[thread]);
+    } else {
+      thread_rngs[thread].seed(seeds[s]);
+      sample_sequence(idle_vehs, num_stations_with_idle_vehs, s,
+          thread_rollouts[thread], *thread_pax_streams[thread],
+          thread_hists[thread]);
+    }
+  }
+}
+
+void BWSamplingVotingHandler::sample_sequence(
+    const std::vector<int> &idle_vehs, int num_stations_with_idle_vehs,
+    size_t s, BWSVRollout &rollout, BWPaxStream &stream,
+    ODHistogram &action_hist) {
+  if (use_scenario_pool) {
+    ASSERT((s + 1) * num_pax <= scenario_pool.size());
+    rollout.run(idle_vehs, num_stations_with_idle_vehs, num_pax,
+        num_pax > 0 ? &scenario_pool[s * num_pax] : NULL, action_hist);
+  } else {
+    rollout.run(idle_vehs, num_stations_with_idle_vehs, num_pax, stream,
+        action_hist);
+  }
+}
+
+void BWSamplingVotingHandler::update_scenario_pool() {
+  if (!scenario_pool.empty() &&
+      scenario_pool_num_sequences == num_sequences &&
+      scenario_pool_num_pax == num_pax &&
+      (scenario_pool_refresh == 0 ||
+       scenario_pool_age < scenario_pool_refresh)) {
+    ++scenario_pool_age;
+    return;
+  }
+
+  scenario_pool.resize(num_sequences * num_pax);
+  for (size_t s = 0; s < num_sequences; ++s) {
+    pax_stream->reset(0);
+    for (size_t p = 0; p < num_pax; ++p) {
+      scenario_pool[s * num_pax + p] = pax_stream->next_pax();
     }
   }
+  scenario_pool_num_sequences = num_sequences;
+  scenario_pool_num_pax = num_pax;
+  scenario_pool_age = 1;
+  ++num_scenario_pool_refreshes;
 }
 
 size_t BWSamplingVotingHandler::best_destin(size_t i,
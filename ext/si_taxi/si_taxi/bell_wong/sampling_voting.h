@@ -7,6 +7,75 @@
 
 namespace si_taxi {
 
+struct BWSVWorkers;
+
+/**
+ * Working storage and inner loop for the sample sequences in
+ * BWSamplingVotingHandler. The vehicles are kept as arrays of destinations and
+ * arrival times, and the trip times are copied into a flat table by
+ * destination, so that choosing and updating the BWSNNHandler vehicle for each
+ * sample request is one pass over contiguous arrays. Once the buffers have
+ * been sized by the first call to init, nothing is allocated.
+ */
+struct BWSVRollout {
+  BWSVRollout() : num_stations(0), now(0), num_stations_with_idle_vehs(0),
+    first_idle_nt_destins_done(0) { }
+
+  /**
+   * Copy the trip times and vehicles from sim, moving the arrive times of idle
+   * vehicles up to now (see BWSamplingVotingHandler::clone_sim_vehs).
+   */
+  void init(const BWSim &sim);
+
+  /**
+   * Generate one sequence of num_pax requests from stream, starting from the
+   * vehicles copied in init, and add its votes to action_hist. The votes are
+   * the same as for the loop over BWSNNHandler::choose_veh and
+   * BWSNNHandler::update_veh on a copy of the vehicles.
+   */
+  void run(const std::vector<int> &idle_vehs, int num_stations_with_idle_vehs,
+      size_t num_pax, BWPaxStream &stream, ODHistogram &action_hist);
+
+  /**
+   * As above, but for a sequence of num_pax requests that has already been
+   * generated; the requests' arrive times are relative to now.
+   */
+  void run(const std::vector<int> &idle_vehs, int num_stations_with_idle_vehs,
+      size_t num_pax, const BWPax *pax, ODHistogram &action_hist);
+
+protected:
+  /// Copy the vehicles from init and clear the features.
+  void start(int num_stations_with_idle_vehs);
+
+  /**
+   * Serve pax with the vehicle chosen by BWSNNHandler::choose_veh, and record
+   * the features.
+   *
+   * @return true if there is a decision for every station with idle vehicles
+   */
+  bool serve(const BWPax &pax);
+
+  /// Add the votes for the current sequence to action_hist.
+  void vote(const std::vector<int> &idle_vehs, ODHistogram &action_hist) const;
+
+  size_t num_stations;
+  BWTime now;
+  int num_stations_with_idle_vehs;
+  int first_idle_nt_destins_done;
+  /// trip_time_to[j * num_stations + i] is the trip time from i to j
+  std::vector<int> trip_time_to;
+  /// vehicles as copied in init
+  std::vector<int> init_destin;
+  std::vector<BWTime> init_arrive;
+  /// vehicles for the current sequence
+  std::vector<int> destin;
+  std::vector<BWTime> arrive;
+  /// features of the current sequence, by station
+  std::vector<int> num_trivial_idle_trips;
+  std::vector<size_t> first_idle_nt_destins; // nt = nontrivial
+  std::vector<size_t> first_destins;
+};
+
 /**
  * The Sampling and Voting (SV) heuristic.
  */
@@ -17,6 +86,9 @@ struct BWSamplingVotingHandler : public BWProactiveHandler {
    */
   BWSamplingVotingHandler(BWSim &sim, BWPaxStream *pax_stream);
 
+  /// Destructor.
+  virtual ~BWSamplingVotingHandler();
+
   /**
    * Override.
    */
@@ -39,10 +111,23 @@ struct BWSamplingVotingHandler : public BWProactiveHandler {
   void clone_sim_vehs(std::vector<BWVehicle> &clone_vehs) const;
 
   /**
-   *
+   * Generate up to num_sequences sample sequences and record the votes for
+   * each station with idle vehicles in action_hist. Fewer sequences are used
+   * if adaptive_sequences is set and the votes are decided, or if
+   * max_decision_seconds runs out.
    */
   void sample(const std::vector<int> &idle_vehs, ODHistogram &action_hist);
 
+  /**
+   * True if, for every station with idle vehicles, the leading destination in
+   * action_hist is either certain to stay ahead over the remaining sequences
+   * or ahead of the runner-up by at least vote_z standard deviations.
+   *
+   * @param num_done number of sequences in action_hist so far
+   */
+  bool votes_decided(const std::vector<int> &idle_vehs,
+      const ODHistogram &action_hist, size_t num_done) const;
+
   /**
    * For a given origin, find the destination with largest weight, breaking ties
    * on minimum trip time.
@@ -65,6 +150,190 @@ struct BWSamplingVotingHandler : public BWProactiveHandler {
 
   /// number of requests to generate per sequence
   size_t num_pax;
+
+  /**
+   * If set, stop generating sequences as soon as the votes are decided (see
+   * votes_decided), after at least min_sequences; default false. With more
+   * than one thread, the votes are checked after every num_threads sequences.
+   */
+  bool adaptive_sequences;
+
+  /// see adaptive_sequences; default 5
+  size_t min_sequences;
+
+  /**
+   * Separation required between the leading and runner-up destinations for
+   * adaptive_sequences. With a and b votes for the leader and runner-up, the
+   * votes are decided when a - b >= vote_z * sqrt(a + b) (a sign test);
+   * default 2.
+   */
+  double vote_z;
+
+  /**
+   * Wall clock budget for each call to sample, in seconds, or zero for no
+   * limit (the default). When it runs out, the votes so far are used. At least
+   * one sequence is always generated.
+   */
+  double max_decision_seconds;
+
+  /**
+   * If set, generate num_sequences sequences of num_pax requests from
+   * pax_stream once and reuse them, shifted to the current time, for later
+   * decisions (common random numbers), instead of generating new sequences
+   * for every decision; default false. This makes consecutive decisions more
+   * consistent and saves the cost of generating the requests. The pool is
+   * generated again every scenario_pool_refresh decisions, or when
+   * num_sequences or num_pax changes. The pool is shared by all threads, so
+   * the results do not depend on num_threads.
+   */
+  bool use_scenario_pool;
+
+  /**
+   * Number of decisions between refreshes of the scenario pool, or zero to
+   * keep it until clear_scenario_pool is called (the default); see
+   * use_scenario_pool.
+   */
+  size_t scenario_pool_refresh;
+
+  /// number of times the scenario pool has been generated
+  size_t num_scenario_pool_refreshes;
+
+  /**
+   * Discard the scenario pool, so it is generated again for the next
+   * decision; see use_scenario_pool.
+   */
+  void clear_scenario_pool();
+
+  /// number of calls to sample that had idle vehicles to move
+  size_t num_decisions;
+
+  /// total number of sequences generated
+  size_t num_sequences_used;
+
+  /// number of sequences generated in the last decision
+  size_t last_num_sequences_used;
+
+  /// number of decisions that stopped early because the votes were decided
+  size_t num_decided_early;
+
+  /// number of decisions that stopped early because of max_decision_seconds
+  size_t num_deadline_stops;
+
+  /// wall clock time for the last decision, in seconds
+  double last_decision_seconds;
+
+  /// longest wall clock time for a decision, in seconds
+  double max_observed_decision_seconds;
+
+  /// total wall clock time for all decisions, in seconds
+  double total_decision_seconds;
+
+  /**
+   * Number of threads to generate sequences in; default 1. If more than one,
+   * each thread uses its own copy of pax_stream (see BWPaxStream::clone), and
+   * each sequence uses its own generator, seeded from sim.rng. The
+   * results for a given seed are then the same for any number of threads
+   * greater than one (but not the same as for one thread). If the stream
+   * can't be copied, the sequences are all generated in the calling thread,
+   * unless use_scenario_pool is set, in which case no copies are needed.
+   *
+   * The calling thread generates its share of each batch of sequences, and
+   * num_threads - 1 worker threads generate the rest. The workers and the
+   * copies of pax_stream are made when they are first needed and kept until
+   * clear_thread_streams is called or the handler is destroyed, so changes
+   * to pax_stream after that do not affect them; call clear_thread_streams to
+   * make new copies.
+   */
+  size_t num_threads;
+
+  /**
+   * Stop the worker threads and delete their copies of pax_stream; see
+   * num_threads.
+   */
+  void clear_thread_streams();
+
+protected:
+  /**
+   * Sample and move idle vehicles at the stations counted in idle_vehs_buffer;
+   * see handle_idle and handle_strobe.
+   */
+  void sample_and_move();
+
+  /**
+   * Generate the scenario pool if it is empty, out of date or due for a
+   * refresh; see use_scenario_pool.
+   */
+  void update_scenario_pool();
+
+  /**
+   * Generate sequence s, from the scenario pool if use_scenario_pool is set,
+   * and add its votes to action_hist.
+   */
+  void sample_sequence(const std::vector<int> &idle_vehs,
+      int num_stations_with_idle_vehs, size_t s, BWSVRollout &rollout,
+      BWPaxStream &stream, ODHistogram &action_hist);
+
+  /**
+   * Generate the sequences s = begin + thread, begin + thread + num_threads,
+   * ... up to end, seeding thread_rngs[thread] with seeds[s] for sequence s,
+   * and add their votes to thread_hists[thread]; see sample_in_threads.
+   */
+  void sample_thread_sequences(const std::vector<int> &idle_vehs,
+      int num_stations_with_idle_vehs, size_t begin, size_t end,
+      size_t thread);
+
+  /**
+   * Make sure there is a copy of pax_stream for each thread (unless
+   * use_scenario_pool is set) and that the worker threads are running.
+   *
+   * @return false if pax_stream can't be copied
+   */
+  bool init_thread_streams();
+
+  /**
+   * Generate sequences begin up to end, split between the calling thread and
+   * the worker threads, and add their votes to action_hist.
+   */
+  void sample_in_threads(const std::vector<int> &idle_vehs,
+      int num_stations_with_idle_vehs, size_t begin, size_t end,
+      ODHistogram &action_hist);
+
+  /**
+   * Main loop for worker thread number thread (from 1); it waits for each
+   * batch from sample_in_threads and generates its share of the sequences,
+   * until clear_thread_streams stops it.
+   */
+  void run_worker(size_t thread);
+
+  /// idle vehicles and votes for handle_idle and handle_strobe
+  std::vector<int> idle_vehs_buffer;
+  ODHistogram action_hist_buffer;
+  /// sequence state for the calling thread
+  BWSVRollout rollout;
+  /// sequence seeds for sample_in_threads
+  std::vector<RNG::result_type> seeds;
+
+  /**
+   * Requests for each sequence in the scenario pool, with arrive times
+   * relative to the start of the sequence; sequence s is stored in
+   * num_pax entries from s * num_pax.
+   */
+  std::vector<BWPax> scenario_pool;
+  /// num_sequences and num_pax when the scenario pool was generated
+  size_t scenario_pool_num_sequences;
+  size_t scenario_pool_num_pax;
+  /// number of decisions since the scenario pool was generated
+  size_t scenario_pool_age;
+
+  /// generators for the worker threads; see num_threads
+  std::vector<RNG> thread_rngs;
+  /// sequence state and votes for each worker thread; see num_threads
+  std::vector<BWSVRollout> thread_rollouts;
+  std::vector<ODHistogram> thread_hists;
+  /// copies of pax_stream for the worker threads; see num_threads
+  std::vector<BWPaxStream *> thread_pax_streams;
+  /// worker threads and the batch they are working on, or null if stopped
+  BWSVWorkers *workers;
 };
 
 }
@@ -18,6 +18,14 @@ void BWSurplusDeficitHandler::init() {
 }
 
 void BWSurplusDeficitHandler::handle_pax_served(size_t empty_origin) {
+  redistribute();
+}
+
+void BWSurplusDeficitHandler::handle_coalesced_events() {
+  redistribute();
+}
+
+void BWSurplusDeficitHandler::redistribute() {
   // count idle vehicles
   vector<int> idle_vehs(sim.num_stations());
   sim.count_idle_vehs(idle_vehs);
@@ -23,12 +23,7 @@ struct BWSurplusDeficitHandler: public BWProactiveHandler {
   virtual void init();
 
   /**
-   * Override.
-   *
-   * For each station i with idle vehicles, in descending order by number
-   * of idle vehicles, if the surplus of vehicles at i is greater than or equal
-   * to one, an idle vehicle at i is sent to the nearest station with surplus
-   * less than zero (if any).
+   * Override; calls redistribute.
    */
   virtual void handle_pax_served(size_t empty_origin);
 
@@ -40,6 +35,19 @@ struct BWSurplusDeficitHandler: public BWProactiveHandler {
    */
   virtual void handle_idle(BWVehicle &veh);
 
+  /**
+   * Override; calls redistribute.
+   */
+  virtual void handle_coalesced_events();
+
+  /**
+   * For each station i with idle vehicles, in descending order by number
+   * of idle vehicles, if the surplus of vehicles at i is greater than or equal
+   * to one, an idle vehicle at i is sent to the nearest station with surplus
+   * less than zero (if any).
+   */
+  void redistribute();
+
   /**
    * The surplus of vehicles at station i is the number of inbound vehicles
    * minus the expected number of requests over the call time.
@@ -0,0 +1,354 @@
+#include "vehicle_kernels.h"
+#include <si_taxi/stdafx.h>
+#include <si_taxi/utility.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace si_taxi {
+
+void bw_empty_times_to(const boost::numeric::ublas::matrix<int> &trip_time,
+    size_t origin, std::vector<int> &empty_time) {
+  ASSERT(origin < trip_time.size2());
+  empty_time.resize(trip_time.size1());
+  for (size_t i = 0; i < empty_time.size(); ++i) {
+    empty_time[i] = trip_time(i, origin);
+  }
+}
+
+#if !defined(__AVX2__) && defined(__SSE2__)
+/// mask ? a : b, lane by lane
+static inline __m128i select_si128(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/// mask ? a : b, lane by lane
+static inline __m128d select_pd(__m128d mask, __m128d a, __m128d b) {
+  return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+/// max(0, x), lane by lane
+static inline __m128i max0_epi32(__m128i x) {
+  return _mm_and_si128(x, _mm_cmpgt_epi32(x, _mm_setzero_si128()));
+}
+#endif
+
+size_t bw_nn_choose_veh(const BWVehicleArrays &vehs,
+    const std::vector<int> &empty_time, int t) {
+  size_t num_veh = vehs.size();
+  if (num_veh == 0)
+    return numeric_limits<size_t>::max();
+  CHECK(num_veh <= (size_t)numeric_limits<int>::max());
+  const int *arrive = &vehs.arrive[0];
+  const int *destin = &vehs.destin[0];
+  const int *empty = &empty_time[0];
+
+  // The vector loops keep the best vehicle in each lane; lane i sees the
+  // vehicles with index i mod the number of lanes, in ascending order. The
+  // lanes are then combined, and the remaining vehicles done one at a time.
+  size_t k_star = numeric_limits<size_t>::max();
+  int w_star = 0;
+  size_t k = 0;
+#if defined(__AVX2__)
+  if (num_veh >= 8) {
+    const __m256i t8 = _mm256_set1_epi32(t);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i k8 = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i best_k = k8;
+    __m256i best_w = zero;
+    for (k = 0; k + 8 <= num_veh; k += 8) {
+      __m256i x = _mm256_max_epi32(zero, _mm256_sub_epi32(
+          _mm256_loadu_si256((const __m256i *)(arrive + k)), t8));
+      __m256i e = _mm256_i32gather_epi32(empty,
+          _mm256_loadu_si256((const __m256i *)(destin + k)), 4);
+      __m256i w = _mm256_add_epi32(x, e);
+      if (k == 0) {
+        best_w = w;
+      } else {
+        k8 = _mm256_add_epi32(k8, _mm256_set1_epi32(8));
+        __m256i lt = _mm256_cmpgt_epi32(best_w, w);
+        best_w = _mm256_blendv_epi8(best_w, w, lt);
+        best_k = _mm256_blendv_epi8(best_k, k8, lt);
+      }
+    }
+    int lane_w[8], lane_k[8];
+    _mm256_storeu_si256((__m256i *)lane_w, best_w);
+    _mm256_storeu_si256((__m256i *)lane_k, best_k);
+    for (size_t i = 0; i < 8; ++i) {
+      if (k_star == numeric_limits<size_t>::max() || lane_w[i] < w_star ||
+          (lane_w[i] == w_star && (size_t)lane_k[i] < k_star)) {
+        k_star = lane_k[i];
+        w_star = lane_w[i];
+      }
+    }
+  }
+#elif defined(__SSE2__)
+  if (num_veh >= 4) {
+    const __m128i t4 = _mm_set1_epi32(t);
+    __m128i k4 = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i best_k = k4;
+    __m128i best_w = _mm_setzero_si128();
+    for (k = 0; k + 4 <= num_veh; k += 4) {
+      __m128i x = max0_epi32(_mm_sub_epi32(
+          _mm_loadu_si128((const __m128i *)(arrive + k)), t4));
+      __m128i e = _mm_setr_epi32(empty[destin[k]], empty[destin[k + 1]],
+          empty[destin[k + 2]], empty[destin[k + 3]]);
+      __m128i w = _mm_add_epi32(x, e);
+      if (k == 0) {
+        best_w = w;
+      } else {
+        k4 = _mm_add_epi32(k4, _mm_set1_epi32(4));
+        __m128i lt = _mm_cmplt_epi32(w, best_w);
+        best_w = select_si128(lt, w, best_w);
+        best_k = select_si128(lt, k4, best_k);
+      }
+    }
+    int lane_w[4], lane_k[4];
+    _mm_storeu_si128((__m128i *)lane_w, best_w);
+    _mm_storeu_si128((__m128i *)lane_k, best_k);
+    for (size_t i = 0; i < 4; ++i) {
+      if (k_star == numeric_limits<size_t>::max() || lane_w[i] < w_star ||
+          (lane_w[i] == w_star && (size_t)lane_k[i] < k_star)) {
+        k_star = lane_k[i];
+        w_star = lane_w[i];
+      }
+    }
+  }
+#endif
+
+  for (; k < num_veh; ++k) {
+    int w_k = max(0, arrive[k] - t) + empty[destin[k]];
+    if (k_star == numeric_limits<size_t>::max() || w_k < w_star) {
+      k_star = k;
+      w_star = w_k;
+    }
+  }
+  return k_star;
+}
+
+size_t bw_etnn_choose_veh(const BWVehicleArrays &vehs,
+    const std::vector<int> &empty_time, int now) {
+  size_t num_veh = vehs.size();
+  if (num_veh == 0)
+    return numeric_limits<size_t>::max();
+  CHECK(num_veh <= (size_t)numeric_limits<int>::max());
+  const int *arrive = &vehs.arrive[0];
+  const int *destin = &vehs.destin[0];
+  const int *empty = &empty_time[0];
+
+  // See bw_nn_choose_veh for the structure.
+  size_t ks = numeric_limits<size_t>::max();
+  int ks_empty = 0;
+  int ks_extra_wait = 0;
+  size_t k = 0;
+#if defined(__AVX2__)
+  if (num_veh >= 8) {
+    const __m256i now8 = _mm256_set1_epi32(now);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i k8 = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i best_k = k8;
+    __m256i best_e = zero;
+    __m256i best_x = zero;
+    for (k = 0; k + 8 <= num_veh; k += 8) {
+      __m256i x = _mm256_max_epi32(zero, _mm256_sub_epi32(
+          _mm256_loadu_si256((const __m256i *)(arrive + k)), now8));
+      __m256i e = _mm256_i32gather_epi32(empty,
+          _mm256_loadu_si256((const __m256i *)(destin + k)), 4);
+      if (k == 0) {
+        best_e = e;
+        best_x = x;
+      } else {
+        k8 = _mm256_add_epi32(k8, _mm256_set1_epi32(8));
+        __m256i lt = _mm256_or_si256(_mm256_cmpgt_epi32(best_e, e),
+            _mm256_and_si256(_mm256_cmpeq_epi32(best_e, e),
+                _mm256_cmpgt_epi32(best_x, x)));
+        best_e = _mm256_blendv_epi8(best_e, e, lt);
+        best_x = _mm256_blendv_epi8(best_x, x, lt);
+        best_k = _mm256_blendv_epi8(best_k, k8, lt);
+      }
+    }
+    int lane_e[8], lane_x[8], lane_k[8];
+    _mm256_storeu_si256((__m256i *)lane_e, best_e);
+    _mm256_storeu_si256((__m256i *)lane_x, best_x);
+    _mm256_storeu_si256((__m256i *)lane_k, best_k);
+    for (size_t i = 0; i < 8; ++i) {
+      if (ks == numeric_limits<size_t>::max() || lane_e[i] < ks_empty || (
+          lane_e[i] == ks_empty && (lane_x[i] < ks_extra_wait || (
+          lane_x[i] == ks_extra_wait && (size_t)lane_k[i] < ks)))) {
+        ks = lane_k[i];
+        ks_empty = lane_e[i];
+        ks_extra_wait = lane_x[i];
+      }
+    }
+  }
+#elif defined(__SSE2__)
+  if (num_veh >= 4) {
+    const __m128i now4 = _mm_set1_epi32(now);
+    __m128i k4 = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i best_k = k4;
+    __m128i best_e = _mm_setzero_si128();
+    __m128i best_x = _mm_setzero_si128();
+    for (k = 0; k + 4 <= num_veh; k += 4) {
+      __m128i x = max0_epi32(_mm_sub_epi32(
+          _mm_loadu_si128((const __m128i *)(arrive + k)), now4));
+      __m128i e = _mm_setr_epi32(empty[destin[k]], empty[destin[k + 1]],
+          empty[destin[k + 2]], empty[destin[k + 3]]);
+      if (k == 0) {
+        best_e = e;
+        best_x = x;
+      } else {
+        k4 = _mm_add_epi32(k4, _mm_set1_epi32(4));
+        __m128i lt = _mm_or_si128(_mm_cmplt_epi32(e, best_e),
+            _mm_and_si128(_mm_cmpeq_epi32(e, best_e),
+                _mm_cmplt_epi32(x, best_x)));
+        best_e = select_si128(lt, e, best_e);
+        best_x = select_si128(lt, x, best_x);
+        best_k = select_si128(lt, k4, best_k);
+      }
+    }
+    int lane_e[4], lane_x[4], lane_k[4];
+    _mm_storeu_si128((__m128i *)lane_e, best_e);
+    _mm_storeu_si128((__m128i *)lane_x, best_x);
+    _mm_storeu_si128((__m128i *)lane_k, best_k);
+    for (size_t i = 0; i < 4; ++i) {
+      if (ks == numeric_limits<size_t>::max() || lane_e[i] < ks_empty || (
+          lane_e[i] == ks_empty && (lane_x[i] < ks_extra_wait || (
+          lane_x[i] == ks_extra_wait && (size_t)lane_k[i] < ks)))) {
+        ks = lane_k[i];
+        ks_empty = lane_e[i];
+        ks_extra_wait = lane_x[i];
+      }
+    }
+  }
+#endif
+
+  for (; k < num_veh; ++k) {
+    int k_empty = empty[destin[k]];
+    int k_extra_wait = max(0, arrive[k] - now);
+    if (ks == numeric_limits<size_t>::max() || k_empty < ks_empty || (
+        k_empty == ks_empty && k_extra_wait < ks_extra_wait)) {
+      ks = k;
+      ks_empty = k_empty;
+      ks_extra_wait = k_extra_wait;
+    }
+  }
+  return ks;
+}
+
+size_t bw_h1_choose_veh(const BWVehicleArrays &vehs,
+    const std::vector<int> &empty_time,
+    const boost::numeric::ublas::vector<double> &expected_trip_time_from,
+    int t, double h, double alpha) {
+  size_t num_veh = vehs.size();
+  if (num_veh == 0)
+    return numeric_limits<size_t>::max();
+  CHECK(num_veh <= (size_t)numeric_limits<int>::max());
+  const int *arrive = &vehs.arrive[0];
+  const int *destin = &vehs.destin[0];
+  const int *empty = &empty_time[0];
+  const double *x = &expected_trip_time_from[0];
+  const double td = t;
+
+  // See bw_nn_choose_veh for the structure. The operations are in the same
+  // order as in BWH1Handler::value; note that max(y, 0) in SSE/AVX returns 0
+  // unless y > 0, which is what std::max(0.0, y) does.
+  size_t k_star = numeric_limits<size_t>::max();
+  double v_star = 0;
+  size_t k = 0;
+#if defined(__AVX2__)
+  if (num_veh >= 4) {
+    const __m128i t4 = _mm_set1_epi32(t);
+    const __m256d td4 = _mm256_set1_pd(td);
+    const __m256d h4 = _mm256_set1_pd(h);
+    const __m256d alpha4 = _mm256_set1_pd(alpha);
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d k4 = _mm256_setr_pd(0, 1, 2, 3);
+    __m256d best_k = k4;
+    __m256d best_v = zero;
+    for (k = 0; k + 4 <= num_veh; k += 4) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(arrive + k));
+      __m128i d = _mm_loadu_si128((const __m128i *)(destin + k));
+      __m128i w = _mm_add_epi32(
+          _mm_max_epi32(_mm_setzero_si128(), _mm_sub_epi32(a, t4)),
+          _mm_i32gather_epi32(empty, d, 4));
+      __m256d y = _mm256_sub_pd(_mm256_sub_pd(_mm256_cvtepi32_pd(a), td4), h4);
+      y = _mm256_add_pd(_mm256_max_pd(y, zero), _mm256_i32gather_pd(x, d, 8));
+      __m256d v = _mm256_sub_pd(_mm256_cvtepi32_pd(w),
+          _mm256_mul_pd(alpha4, y));
+      if (k == 0) {
+        best_v = v;
+      } else {
+        k4 = _mm256_add_pd(k4, _mm256_set1_pd(4));
+        __m256d lt = _mm256_cmp_pd(v, best_v, _CMP_LT_OQ);
+        best_v = _mm256_blendv_pd(best_v, v, lt);
+        best_k = _mm256_blendv_pd(best_k, k4, lt);
+      }
+    }
+    double lane_v[4], lane_k[4];
+    _mm256_storeu_pd(lane_v, best_v);
+    _mm256_storeu_pd(lane_k, best_k);
+    for (size_t i = 0; i < 4; ++i) {
+      if (k_star == numeric_limits<size_t>::max() || lane_v[i] < v_star ||
+          (lane_v[i] == v_star && (size_t)lane_k[i] < k_star)) {
+        k_star = (size_t)lane_k[i];
+        v_star = lane_v[i];
+      }
+    }
+  }
+#elif defined(__SSE2__)
+  if (num_veh >= 2) {
+    const __m128i t2 = _mm_set1_epi32(t);
+    const __m128d td2 = _mm_set1_pd(td);
+    const __m128d h2 = _mm_set1_pd(h);
+    const __m128d alpha2 = _mm_set1_pd(alpha);
+    const __m128d zero = _mm_setzero_pd();
+    __m128d k2 = _mm_setr_pd(0, 1);
+    __m128d best_k = k2;
+    __m128d best_v = zero;
+    for (k = 0; k + 2 <= num_veh; k += 2) {
+      __m128i a = _mm_loadl_epi64((const __m128i *)(arrive + k));
+      __m128i w = _mm_add_epi32(max0_epi32(_mm_sub_epi32(a, t2)),
+          _mm_setr_epi32(empty[destin[k]], empty[destin[k + 1]], 0, 0));
+      __m128d y = _mm_sub_pd(_mm_sub_pd(_mm_cvtepi32_pd(a), td2), h2);
+      y = _mm_add_pd(_mm_max_pd(y, zero),
+          _mm_setr_pd(x[destin[k]], x[destin[k + 1]]));
+      __m128d v = _mm_sub_pd(_mm_cvtepi32_pd(w), _mm_mul_pd(alpha2, y));
+      if (k == 0) {
+        best_v = v;
+      } else {
+        k2 = _mm_add_pd(k2, _mm_set1_pd(2));
+        __m128d lt = _mm_cmplt_pd(v, best_v);
+        best_v = select_pd(lt, v, best_v);
+        best_k = select_pd(lt, k2, best_k);
+      }
+    }
+    double lane_v[2], lane_k[2];
+    _mm_storeu_pd(lane_v, best_v);
+    _mm_storeu_pd(lane_k, best_k);
+    for (size_t i = 0; i < 2; ++i) {
+      if (k_star == numeric_limits<size_t>::max() || lane_v[i] < v_star ||
+          (lane_v[i] == v_star && (size_t)lane_k[i] < k_star)) {
+        k_star = (size_t)lane_k[i];
+        v_star = lane_v[i];
+      }
+    }
+  }
+#endif
+
+  for (; k < num_veh; ++k) {
+    int w_k = max(0, arrive[k] - t) + empty[destin[k]];
+    double v_k = w_k - alpha * (max(0.0, arrive[k] - td - h) + x[destin[k]]);
+    if (k_star == numeric_limits<size_t>::max() || v_k < v_star) {
+      k_star = k;
+      v_star = v_k;
+    }
+  }
+  return k_star;
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef SI_TAXI_BELL_WONG_VEHICLE_KERNELS_H_
+#define SI_TAXI_BELL_WONG_VEHICLE_KERNELS_H_
+
+#include "bell_wong.h"
+
+namespace si_taxi {
+
+/**
+ * Loops that score every vehicle in a BWVehicleArrays and return the index of
+ * the best one. These are the inner loops of BWNNHandler, BWETNNHandler and
+ * BWH1Handler, rewritten so that the compiler does not have to chase the
+ * vehicles through the ublas trip time matrix.
+ *
+ * There are SSE2 and AVX2 versions, which are used when the library is built
+ * with the corresponding instruction set enabled (e.g. -mavx2), and plain
+ * versions otherwise. All versions compute the same scores with the same
+ * operations, and they break ties in favour of the lowest index, so they
+ * choose exactly the same vehicle as the handlers' own loops. (For
+ * BWH1Handler, this assumes that the compiler does not contract the scalar
+ * multiply and subtract into a fused multiply-add; use -ffp-contract=off if
+ * you enable FMA instructions.)
+ */
+
+/**
+ * Fill empty_time with the trip time from each station to the given origin.
+ *
+ * @param empty_time [out] resized to the number of stations
+ */
+void bw_empty_times_to(const boost::numeric::ublas::matrix<int> &trip_time,
+    size_t origin, std::vector<int> &empty_time);
+
+/**
+ * Vehicle that minimises the BWNN wait,
+ *   max(0, arrive - t) + empty_time[destin].
+ *
+ * @param empty_time see bw_empty_times_to
+ * @param t the request's arrival time
+ * @return numeric_limits<size_t>::max() if there are no vehicles
+ */
+size_t bw_nn_choose_veh(const BWVehicleArrays &vehs,
+    const std::vector<int> &empty_time, int t);
+
+/**
+ * Vehicle that minimises empty_time[destin], then max(0, arrive - now), as
+ * in BWETNNHandler.
+ *
+ * @param empty_time see bw_empty_times_to
+ * @return numeric_limits<size_t>::max() if there are no vehicles
+ */
+size_t bw_etnn_choose_veh(const BWVehicleArrays &vehs,
+    const std::vector<int> &empty_time, int now);
+
+/**
+ * Vehicle that minimises the BWH1Handler objective,
+ *   wait - alpha * (max(0, arrive - t - h) + expected_trip_time_from[destin])
+ * where wait is as for bw_nn_choose_veh.
+ *
+ * @param empty_time see bw_empty_times_to
+ * @param expected_trip_time_from see BWH1Handler::expected_trip_time_from
+ * @param t the request's arrival time
+ * @param h expected interarrival time
+ * @param alpha see BWHxHandler::alpha
+ * @return numeric_limits<size_t>::max() if there are no vehicles
+ */
+size_t bw_h1_choose_veh(const BWVehicleArrays &vehs,
+    const std::vector<int> &empty_time,
+    const boost::numeric::ublas::vector<double> &expected_trip_time_from,
+    int t, double h, double alpha);
+
+}
+
+#endif // guard
@@ -6,7 +6,8 @@
 namespace si_taxi {
 
 EmpiricalSampler::EmpiricalSampler(
-    const std::vector<double> &cdf, double cdf_tol) : cdf(cdf)
+    const std::vector<double> &cdf, double cdf_tol,
+    EmpiricalSamplerMethod method) : cdf(cdf), _method(method)
 {
   // the sum is susceptible to rounding errors, which might give us a cdf in
   // which the probability of the last element is slightly less than 1, which
@@ -16,14 +17,79 @@ EmpiricalSampler::EmpiricalSampler(
     CHECK(fabs(1.0 - this->cdf[this->cdf.size() - 1]) < cdf_tol);
     this->cdf[this->cdf.size() - 1] = 1.0;
   }
+
+  switch (_method) {
+  case EMPIRICAL_SAMPLER_BINARY_SEARCH:
+    break;
+  case EMPIRICAL_SAMPLER_ALIAS:
+    build_alias_table();
+    break;
+  default:
+    FAIL("unknown method: " << _method);
+  }
 }
 
 EmpiricalSampler EmpiricalSampler::from_pmf(
-    const std::vector<double> &pmf, double cdf_tol)
+    const std::vector<double> &pmf, double cdf_tol,
+    EmpiricalSamplerMethod method)
 {
   std::vector<double> cdf(pmf.size());
   std::partial_sum(pmf.begin(), pmf.end(), cdf.begin());
-  return EmpiricalSampler(cdf, cdf_tol);
+  return EmpiricalSampler(cdf, cdf_tol, method);
+}
+
+void EmpiricalSampler::build_alias_table() {
+  // recover the pmf from the cdf, and keep only the bins with non-zero
+  // probability; the last entry of the cdf is exactly 1, so the scaled
+  // probabilities sum to the number of slots (up to rounding); because we
+  // fixed the last entry, it can come out slightly negative for a zero bin
+  std::vector<size_t> bins;
+  std::vector<double> scaled;
+  for (size_t k = 0; k < cdf.size(); ++k) {
+    double p = cdf[k] - (k > 0 ? cdf[k - 1] : 0.0);
+    if (p > 0) {
+      bins.push_back(k);
+      scaled.push_back(p);
+    }
+  }
+  size_t m = bins.size();
+  for (size_t i = 0; i < m; ++i) {
+    scaled[i] *= m;
+  }
+
+  // Vose's construction: pair each slot with less than its share with a slot
+  // that has more, until all are full
+  alias_table.resize(m);
+  std::vector<size_t> small, large;
+  for (size_t i = 0; i < m; ++i) {
+    if (scaled[i] < 1.0)
+      small.push_back(i);
+    else
+      large.push_back(i);
+  }
+  while (!small.empty() && !large.empty()) {
+    size_t s = small.back();
+    size_t l = large.back();
+    small.pop_back();
+    alias_table[s].threshold = scaled[s];
+    alias_table[s].bin = bins[s];
+    alias_table[s].alias = bins[l];
+    scaled[l] -= 1.0 - scaled[s];
+    if (scaled[l] < 1.0) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+
+  // whatever is left is full, up to rounding
+  for (size_t i = 0; i < large.size(); ++i) {
+    alias_table[large[i]].threshold = 1.0;
+    alias_table[large[i]].bin = alias_table[large[i]].alias = bins[large[i]];
+  }
+  for (size_t i = 0; i < small.size(); ++i) {
+    alias_table[small[i]].threshold = 1.0;
+    alias_table[small[i]].bin = alias_table[small[i]].alias = bins[small[i]];
+  }
 }
 
 size_t EmpiricalSampler::pick(double r) const {
@@ -35,11 +101,33 @@ size_t EmpiricalSampler::pick(double r) const {
   return it - cdf.begin();
 }
 
+size_t EmpiricalSampler::pick_alias(double u) const {
+  ASSERT(!alias_table.empty());
+  ASSERT(0 <= u && u < 1);
+  double x = u * alias_table.size();
+  size_t i = (size_t)x;
+  if (i >= alias_table.size()) // in case of rounding
+    i = alias_table.size() - 1;
+  const AliasSlot &slot = alias_table[i];
+  return x - i < slot.threshold ? slot.bin : slot.alias;
+}
+
 size_t EmpiricalSampler::sample() const {
+  return sample(si_taxi::rng);
+}
+
+size_t EmpiricalSampler::pick_uniform(double u) const {
+  if (_method == EMPIRICAL_SAMPLER_ALIAS)
+    return pick_alias(u);
+
   // we want a random number in (0, 1], so lower_bound won't pick entries
   // with zero probability at the start of the cdf; this is why we use 1 -
   // a random value, which is in range [0, 1)
-  return pick(1 - genrand_c01o<double>(si_taxi::rng));
+  return pick(1 - u);
+}
+
+size_t EmpiricalSampler::sample(RNG &rng) const {
+  return pick_uniform(genrand_c01o<double>(rng));
 }
 
 }
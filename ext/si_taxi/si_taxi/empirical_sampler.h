@@ -5,19 +5,38 @@
 
 namespace si_taxi {
 
+/**
+ * How EmpiricalSampler::sample finds a bin.
+ */
+enum EmpiricalSamplerMethod {
+  /**
+   * Binary search on the cdf; O(log n) per sample for n bins.
+   */
+  EMPIRICAL_SAMPLER_BINARY_SEARCH,
+  /**
+   * Walker's alias method, with Vose's construction; O(1) per sample, after
+   * O(n) setup. Only bins with non-zero probability are in the table, so
+   * structurally zero bins (e.g. the diagonal of an OD matrix) cost nothing.
+   * The samples have the same distribution as for the binary search, but not
+   * the same sequence for a given seed.
+   */
+  EMPIRICAL_SAMPLER_ALIAS
+};
+
 /**
  * Efficient sampling from an empirical distribution.
  *
  * The distribution can be specified as a probability mass function (pmf) or
- * a cumulative distribution function (cdf). Sampling is always performed on
- * the cdf, because this allows us to find the right bin with a binary search.
+ * a cumulative distribution function (cdf). By default, sampling is performed
+ * on the cdf, because this allows us to find the right bin with a binary
+ * search; see EmpiricalSamplerMethod for the alternative.
  */
 struct EmpiricalSampler {
   /**
    * Constructs a non-functional sampler; this default constructor is provided
    * for convenience only.
    */
-  EmpiricalSampler() { }
+  EmpiricalSampler() : _method(EMPIRICAL_SAMPLER_BINARY_SEARCH) { }
 
   /**
    * @param cdf cumulative distribution function
@@ -25,8 +44,11 @@ struct EmpiricalSampler {
    * @param cdf_tol error checking: the last entry of the cdf should be 1, by
    *        definition; if it is out by more than this amount, an error is
    *        raised
+   *
+   * @param method see EmpiricalSamplerMethod
    */
-  EmpiricalSampler(const std::vector<double> &cdf, double cdf_tol=1e-5);
+  EmpiricalSampler(const std::vector<double> &cdf, double cdf_tol=1e-5,
+      EmpiricalSamplerMethod method=EMPIRICAL_SAMPLER_BINARY_SEARCH);
 
   /**
    * Create an Empirical Sampler from a probability mass function (pmf); this
@@ -39,9 +61,12 @@ struct EmpiricalSampler {
    * @param cdf_tol error checking: the last entry of the cdf should be 1, by
    *        definition; if it is out by more than this amount, an error is
    *        raised
+   *
+   * @param method see EmpiricalSamplerMethod
    */
   static EmpiricalSampler from_pmf(const std::vector<double> &pmf,
-      double cdf_tol=1e-5);
+      double cdf_tol=1e-5,
+      EmpiricalSamplerMethod method=EMPIRICAL_SAMPLER_BINARY_SEARCH);
 
   /**
    * Supremum of the values that can be returned by sample(); this is the
@@ -63,6 +88,30 @@ struct EmpiricalSampler {
    */
   size_t pick(double r) const;
 
+  /**
+   * Pick a bin from the alias table with the given value; you probably want
+   * to call sample(), which calls this method with a random value when the
+   * method is EMPIRICAL_SAMPLER_ALIAS.
+   *
+   * It is an error to call pick_alias unless the method is
+   * EMPIRICAL_SAMPLER_ALIAS and sup() is non-zero.
+   *
+   * @param u in [0, 1)
+   *
+   * @return in [0, sup()); never a bin with zero probability
+   */
+  size_t pick_alias(double u) const;
+
+  /**
+   * Pick a bin with the given value, using pick or pick_alias according to the
+   * method; sample() calls this with a random value.
+   *
+   * @param u in [0, 1)
+   *
+   * @return in [0, sup())
+   */
+  size_t pick_uniform(double u) const;
+
   /**
    * Pick a random bin.
    *
@@ -72,8 +121,30 @@ struct EmpiricalSampler {
    */
   size_t sample() const;
 
+  /**
+   * As sample(), but using the given generator instead of si_taxi::rng.
+   */
+  size_t sample(RNG &rng) const;
+
+  /// See constructor.
+  inline EmpiricalSamplerMethod method() const {
+    return _method;
+  }
+
 private:
+  /// Fill alias_table from cdf.
+  void build_alias_table();
+
+  /// a slot in the alias table: pick bin if u < threshold, else alias
+  struct AliasSlot {
+    double threshold;
+    size_t bin;
+    size_t alias;
+  };
+
   std::vector<double> cdf;
+  EmpiricalSamplerMethod _method;
+  std::vector<AliasSlot> alias_table;
 };
 
 }
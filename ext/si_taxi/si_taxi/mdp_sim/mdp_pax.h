@@ -1,24 +1,30 @@
 #ifndef MDP_PAX_H_
 #define MDP_PAX_H_
 
+#include <si_taxi/si_taxi.h>
+
 namespace si_taxi {
 
 /**
- * A 32-bit time index is typically adequate.
+ * A 32-bit time index is typically adequate; see SI_TAXI_TIME_BITS.
  *
  * Differences of times are often computed, so a signed type is needed.
  *
  * This is here so SWIG can see it before it loads mdp_sim.h.
  */
+#if SI_TAXI_TIME_BITS == 32
+typedef int MDPTime;
+#else
 typedef long MDPTime;
+#endif
 
 /**
  * Passenger. The MDP model uses discrete time, but it is useful to keep track
  * of exactly when passengers arrived within the (fairly large) MDP time steps.
  */
 struct MDPPax {
-  size_t origin;
-  size_t destin;
+  StationIndex origin;
+  StationIndex destin;
   double arrive;
 
   MDPPax() { }
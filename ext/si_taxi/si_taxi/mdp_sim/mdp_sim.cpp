@@ -9,17 +9,37 @@ namespace si_taxi {
 MDPSim::MDPSim() : stats(NULL), now(-1), queue_max(0) { }
 
 void MDPSim::add_vehicles_in_turn(size_t num_veh, size_t station) {
-  if (num_veh > 0) {
-    CHECK(inbound.size() > 0);
-    station = station % inbound.size();
-    inbound[station].push_front(-1);
-    add_vehicles_in_turn(num_veh - 1, station + 1);
+  if (num_veh == 0)
+    return;
+  CHECK(inbound.size() > 0);
+  // Each station gets num_veh / n vehicles, and the first num_veh % n
+  // stations from the given station get one more.
+  size_t n = inbound.size();
+  station = station % n;
+  for (size_t m = 0; m < n; ++m) {
+    size_t count = num_veh / n + (m < num_veh % n ? 1 : 0);
+    std::deque<MDPTime> &inbound_i = inbound[(station + m) % n];
+    inbound_i.insert(inbound_i.begin(), count, -1);
   }
 }
 
+void MDPSim::add_vehicles_at(const std::vector<int> &counts) {
+  CHECK(counts.size() == inbound.size());
+  for (size_t i = 0; i < counts.size(); ++i) {
+    CHECK(counts[i] >= 0);
+    inbound[i].insert(inbound[i].begin(), counts[i], -1);
+  }
+}
+
+void MDPSim::add_vehicles_in_proportion(size_t num_veh,
+    const std::vector<double> &weights) {
+  add_vehicles_at(apportion(num_veh, weights));
+}
+
 void MDPSim::init() {
   CHECK(trip_time.size1() == num_stations());
   CHECK(trip_time.size2() == num_stations());
+  check_station_index_range(num_stations());
 
   queue.clear();
   queue.resize(num_stations());
@@ -368,7 +388,7 @@ void MDPSimStats::record_pax_to_be_served(const MDPPax &pax)
 
 MDPPoissonPaxStream::MDPPoissonPaxStream(double now, double step,
     const boost::numeric::ublas::matrix<double> &od) :
-    now(now), step(step), last_time(now), _od(od), _pax_i(0)
+    now(now), step(step), last_time(now), batch_size(1), _od(od), _pax_i(0)
 {
   _pax[0] = std::vector<MDPPax>();
   _pax[1] = std::vector<MDPPax>();
@@ -376,9 +396,17 @@ MDPPoissonPaxStream::MDPPoissonPaxStream(double now, double step,
 
 void MDPPoissonPaxStream::generate(MDPPax &pax)
 {
+  size_t origin, destin;
   double interval;
-  _od.sample(BYREF pax.origin, BYREF pax.destin, BYREF interval);
+  if (batch_size > 1) {
+    _buffer.sample(_od, batch_size, BYREF origin, BYREF destin,
+        BYREF interval, rng.get());
+  } else {
+    _od.sample(BYREF origin, BYREF destin, BYREF interval, rng.get());
+  }
   last_time += interval;
+  pax.origin = origin;
+  pax.destin = destin;
   pax.arrive = last_time;
 }
 
@@ -424,6 +452,7 @@ void MDPPoissonPaxStream::reset(double now)
   this->last_time = now;
   _pax[0].clear();
   _pax[1].clear();
+  _buffer.clear();
 }
 
 }
@@ -62,6 +62,12 @@ struct MDPSim {
    */
   int_vector_t available;
 
+  /**
+   * Generator for solvers that need random numbers (e.g.
+   * EpsilonGreedySarsaActor); draws from si_taxi::rng until seeded.
+   */
+  RNGStream rng;
+
   MDPSim();
 
   /**
@@ -87,6 +93,23 @@ struct MDPSim {
    */
   void add_vehicles_in_turn(size_t num_veh, size_t station = 0);
 
+  /**
+   * Add idle vehicles according to the given counts: counts[i] vehicles at
+   * station i.
+   *
+   * @param counts num_stations non-negative entries
+   */
+  void add_vehicles_at(const std::vector<int> &counts);
+
+  /**
+   * Add num_veh idle vehicles, distributed in proportion to the given
+   * weights; see apportion.
+   *
+   * @param weights num_stations non-negative entries, not all zero
+   */
+  void add_vehicles_in_proportion(size_t num_veh,
+      const std::vector<double> &weights);
+
   /**
    * Call after initialising trip_time but before adding vehicles (e.g. with
    * add_vehicles_in_turn) and before the first tick. This method does some
@@ -234,6 +257,9 @@ struct MDPPaxStream {
    * at time 'now.'
    */
   virtual void reset(double now) = 0;
+
+  /// generator for requests; draws from si_taxi::rng until seeded
+  RNGStream rng;
 };
 
 /**
@@ -267,6 +293,12 @@ struct MDPPoissonPaxStream : public MDPPaxStream {
   /// time at which the last request was be generated, in seconds
   double last_time;
 
+  /**
+   * If more than one, generate requests this many at a time; see
+   * BWPoissonPaxStream::batch_size. Default 1.
+   */
+  size_t batch_size;
+
   /**
    * Demand matrix with entries in vehicle trips / second.
    */
@@ -287,6 +319,9 @@ protected:
 
   /// index of the current pax vector
   size_t _pax_i;
+
+  /// see batch_size
+  ODSampleBuffer _buffer;
 };
 
 }
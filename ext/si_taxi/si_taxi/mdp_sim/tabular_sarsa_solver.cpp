@@ -188,7 +188,8 @@ struct F_random_qsa {
     // select random action
     CHECK(actions.size() > 0); // all states have actions (no terminals)
     boost::uniform_int<> random_index(0, actions.size() - 1);
-    const TabularSarsaSolver::sa_t &sa = actions.at(random_index(rng));
+    const TabularSarsaSolver::sa_t &sa =
+      actions.at(random_index(solver.sim->rng.get()));
 
     // update the solver's action
     CHECK(sa.size() == solver.state_action_size());
@@ -232,7 +233,7 @@ void EpsilonGreedySarsaActor::select_action(TabularSarsaSolver::sa_t &sa) {
   solver.sim->count_idle_by(solver.sim->now, solver.sim->available);
 
   // now ready to select action
-  if (genrand_c01o<double>(rng) < epsilon) {
+  if (genrand_c01o<double>(solver.sim->rng.get()) < epsilon) {
     // make a list of all feasible actions and choose a random one
     F_random_qsa f(solver);
     each_square_matrix_with_row_sums_lte(sa,
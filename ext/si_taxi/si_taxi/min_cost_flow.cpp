@@ -0,0 +1,486 @@
+#include "stdafx.h"
+#include "min_cost_flow.h"
+#include "utility.h"
+
+#include <limits>
+#include <queue>
+
+extern "C" {
+#include "relax4.h"
+}
+
+using namespace std;
+
+namespace si_taxi {
+
+MinCostFlowSolver *new_min_cost_flow_solver(MinCostFlowSolverType type) {
+  switch (type) {
+  case MIN_COST_FLOW_RELAX4:
+    return new Relax4Solver();
+  case MIN_COST_FLOW_NETWORK_SIMPLEX:
+    return new NetworkSimplexSolver();
+  case MIN_COST_FLOW_SUCCESSIVE_SHORTEST_PATH:
+    return new SuccessiveShortestPathSolver();
+  }
+  FAIL("unknown min cost flow solver type: " << type);
+}
+
+//
+// Relax4Solver
+//
+
+Relax4Solver::~Relax4Solver() {
+  relax4_free(_state);
+}
+
+void Relax4Solver::init(int num_nodes, int num_arcs,
+    int *start_nodes, int *end_nodes, int *costs,
+    int *capacities, int *demands, int *flows) {
+  relax4_free(_state);
+  _state = NULL;
+  _have_prices = false;
+  CHECK(RELAX4_OK == relax4_init(&_state, num_nodes, num_arcs,
+      start_nodes, end_nodes, costs, capacities,
+      demands, flows, RELAX4_DEFAULT_LARGE));
+}
+
+bool Relax4Solver::solve(bool warm_start) {
+  ASSERT(_state);
+  ASSERT(RELAX4_OK == relax4_check_inputs(_state, RELAX4_DEFAULT_MAX_COST));
+  int result;
+  if (warm_start && _have_prices) {
+    result = relax4_init_warm(_state);
+  } else {
+    result = relax4_init_phase_1(_state);
+    if (RELAX4_OK == result)
+      result = relax4_init_phase_2(_state);
+  }
+  if (RELAX4_OK == result) {
+    result = relax4_run(_state);
+    _have_prices = true;
+  }
+
+  if (RELAX4_INFEASIBLE == result)
+    return false;
+  CHECK(RELAX4_OK == result);
+  ASSERT(RELAX4_OK == relax4_check_output(_state));
+  return true;
+}
+
+//
+// NetworkSimplexSolver
+//
+
+void NetworkSimplexSolver::init(int num_nodes, int num_arcs,
+    int *start_nodes, int *end_nodes, int *costs,
+    int *capacities, int *demands, int *flows) {
+  CHECK(num_nodes > 0);
+  CHECK(num_arcs >= 0);
+  _num_nodes = num_nodes;
+  _num_arcs = num_arcs;
+  _start_nodes = start_nodes;
+  _end_nodes = end_nodes;
+  _costs = costs;
+  _capacities = capacities;
+  _demands = demands;
+  _flows = flows;
+
+  int num_all_nodes = num_nodes + 1;
+  int num_all_arcs = num_arcs + num_nodes;
+  _source.resize(num_all_arcs);
+  _target.resize(num_all_arcs);
+  _cost.resize(num_all_arcs);
+  _cap.resize(num_all_arcs);
+  _flow.resize(num_all_arcs);
+  _state.resize(num_all_arcs);
+  _parent.resize(num_all_nodes);
+  _pred.resize(num_all_nodes);
+  _depth.resize(num_all_nodes);
+  _pi.resize(num_all_nodes);
+  _order.resize(num_all_nodes);
+  _child_start.resize(num_all_nodes + 1);
+  _children.resize(num_all_nodes);
+
+  long max_cost = 1;
+  for (int a = 0; a < num_arcs; ++a) {
+    _source[a] = start_nodes[a] - 1;
+    _target[a] = end_nodes[a] - 1;
+    _cost[a] = costs[a];
+    max_cost = max(max_cost, labs(_cost[a]));
+  }
+
+  // Artificial arcs to or from the root are more expensive than any path
+  // through the real arcs, so they carry flow only if the problem is
+  // infeasible.
+  for (int i = 0; i < num_nodes; ++i) {
+    _cost[num_arcs + i] = (num_nodes + 1) * max_cost;
+  }
+
+  _block_size = max(10, (int)sqrt((double)num_all_arcs));
+}
+
+bool NetworkSimplexSolver::solve(bool /*warm_start*/) {
+  int root = _num_nodes;
+
+  // All real arcs start at their lower bounds, and the supply at each node
+  // goes to (or the demand comes from) the root on an artificial arc.
+  for (int a = 0; a < _num_arcs; ++a) {
+    _cap[a] = _capacities[a];
+    _flow[a] = 0;
+    _state[a] = 1;
+  }
+
+  long net_supply = 0;
+  for (int i = 0; i < _num_nodes; ++i) {
+    int a = _num_arcs + i;
+    int supply = -_demands[i];
+    if (supply >= 0) {
+      _source[a] = i;
+      _target[a] = root;
+      _flow[a] = supply;
+    } else {
+      _source[a] = root;
+      _target[a] = i;
+      _flow[a] = -supply;
+    }
+    _cap[a] = numeric_limits<int>::max();
+    _state[a] = 0;
+    _parent[i] = root;
+    _pred[i] = a;
+    net_supply += supply;
+  }
+  if (net_supply != 0)
+    return false;
+
+  _parent[root] = -1;
+  _pred[root] = -1;
+  _next_arc = 0;
+  update_tree();
+
+  while (find_entering_arc()) {
+    pivot();
+  }
+
+  for (int i = 0; i < _num_nodes; ++i) {
+    if (_flow[_num_arcs + i] > 0)
+      return false;
+  }
+  copy(_flow.begin(), _flow.begin() + _num_arcs, _flows);
+  return true;
+}
+
+bool NetworkSimplexSolver::find_entering_arc() {
+  // Block search: take the most negative of the (signed) reduced costs in the
+  // first block of arcs that has a negative one, starting after the block in
+  // which the last entering arc was found.
+  int num_all_arcs = _num_arcs + _num_nodes;
+  long min_rc = 0;
+  int count = _block_size;
+  int e = _next_arc;
+  for (int k = 0; k < num_all_arcs; ++k) {
+    long rc = _state[e] * (_cost[e] + _pi[_source[e]] - _pi[_target[e]]);
+    if (rc < min_rc) {
+      min_rc = rc;
+      _in_arc = e;
+    }
+    if (++e == num_all_arcs)
+      e = 0;
+    if (--count == 0) {
+      if (min_rc < 0)
+        break;
+      count = _block_size;
+    }
+  }
+  _next_arc = e;
+  return min_rc < 0;
+}
+
+void NetworkSimplexSolver::pivot() {
+  // Flow goes around the cycle from first to second on the entering arc and
+  // then back to first through the tree.
+  int e = _in_arc;
+  int first, second;
+  if (_state[e] == 1) {
+    first = _source[e];
+    second = _target[e];
+  } else {
+    first = _target[e];
+    second = _source[e];
+  }
+
+  int u = first;
+  int v = second;
+  while (u != v) {
+    if (_depth[u] >= _depth[v])
+      u = _parent[u];
+    else
+      v = _parent[v];
+  }
+  int join = u;
+
+  // Find the leaving arc; ties go to the last blocking arc in the direction
+  // of the cycle, which keeps the tree strongly feasible.
+  long delta = _cap[e];
+  int u_out = -1;
+  int result = 0;
+  for (u = first; u != join; u = _parent[u]) {
+    int a = _pred[u];
+    long d = _source[a] == u ? _flow[a] : (long)_cap[a] - _flow[a];
+    if (d < delta) {
+      delta = d;
+      u_out = u;
+      result = 1;
+    }
+  }
+  for (u = second; u != join; u = _parent[u]) {
+    int a = _pred[u];
+    long d = _source[a] == u ? (long)_cap[a] - _flow[a] : _flow[a];
+    if (d <= delta) {
+      delta = d;
+      u_out = u;
+      result = 2;
+    }
+  }
+
+  if (delta > 0) {
+    int val = _state[e] * delta;
+    _flow[e] += val;
+    for (u = _source[e]; u != join; u = _parent[u]) {
+      int a = _pred[u];
+      _flow[a] += _source[a] == u ? -val : val;
+    }
+    for (u = _target[e]; u != join; u = _parent[u]) {
+      int a = _pred[u];
+      _flow[a] += _source[a] == u ? val : -val;
+    }
+  }
+
+  if (result == 0) {
+    // The entering arc just moves to its other bound.
+    _state[e] = -_state[e];
+    return;
+  }
+
+  int leave = _pred[u_out];
+  _state[leave] = _flow[leave] == 0 ? 1 : -1;
+  _state[e] = 0;
+
+  // Hang the subtree that was below the leaving arc from the entering arc,
+  // reversing the parent pointers on the path from u_in up to u_out.
+  int u_in = result == 1 ? first : second;
+  int v_in = result == 1 ? second : first;
+  int x = u_in;
+  int new_parent = v_in;
+  int new_pred = e;
+  for (;;) {
+    int old_parent = _parent[x];
+    int old_pred = _pred[x];
+    _parent[x] = new_parent;
+    _pred[x] = new_pred;
+    if (x == u_out)
+      break;
+    new_parent = x;
+    new_pred = old_pred;
+    x = old_parent;
+  }
+
+  update_tree();
+}
+
+void NetworkSimplexSolver::update_tree() {
+  int num_all_nodes = _num_nodes + 1;
+  int root = _num_nodes;
+
+  // Child lists, by counting sort on the parents.
+  fill(_child_start.begin(), _child_start.end(), 0);
+  for (int i = 0; i < num_all_nodes; ++i) {
+    if (i != root)
+      ++_child_start[_parent[i] + 1];
+  }
+  for (int i = 0; i < num_all_nodes; ++i) {
+    _child_start[i + 1] += _child_start[i];
+  }
+  for (int i = 0; i < num_all_nodes; ++i) {
+    if (i != root)
+      _children[_child_start[_parent[i]]++] = i;
+  }
+  for (int i = num_all_nodes; i > 0; --i) {
+    _child_start[i] = _child_start[i - 1];
+  }
+  _child_start[0] = 0;
+
+  // Breadth first from the root; the reduced cost of each tree arc is zero.
+  _order[0] = root;
+  _depth[root] = 0;
+  _pi[root] = 0;
+  int tail = 1;
+  for (int head = 0; head < tail; ++head) {
+    int x = _order[head];
+    for (int c = _child_start[x]; c < _child_start[x + 1]; ++c) {
+      int y = _children[c];
+      int a = _pred[y];
+      _depth[y] = _depth[x] + 1;
+      _pi[y] = _source[a] == y ? _pi[x] - _cost[a] : _pi[x] + _cost[a];
+      _order[tail++] = y;
+    }
+  }
+  ASSERT(tail == num_all_nodes);
+}
+
+//
+// SuccessiveShortestPathSolver
+//
+
+void SuccessiveShortestPathSolver::init(int num_nodes, int num_arcs,
+    int *start_nodes, int *end_nodes, int *costs,
+    int *capacities, int *demands, int *flows) {
+  CHECK(num_nodes > 0);
+  CHECK(num_arcs >= 0);
+  _num_nodes = num_nodes;
+  _num_arcs = num_arcs;
+  _start_nodes = start_nodes;
+  _end_nodes = end_nodes;
+  _costs = costs;
+  _capacities = capacities;
+  _demands = demands;
+  _flows = flows;
+
+  // Residual arcs, grouped by tail node.
+  _out_start.assign(num_nodes + 1, 0);
+  for (int a = 0; a < num_arcs; ++a) {
+    CHECK(costs[a] >= 0);
+    ++_out_start[start_nodes[a]];
+    ++_out_start[end_nodes[a]];
+  }
+  for (int i = 0; i < num_nodes; ++i) {
+    _out_start[i + 1] += _out_start[i];
+  }
+  _out.resize(2 * num_arcs);
+  std::vector<int> next(_out_start.begin(), _out_start.end() - 1);
+  for (int a = 0; a < num_arcs; ++a) {
+    _out[next[start_nodes[a] - 1]++] = 2 * a;
+    _out[next[end_nodes[a] - 1]++] = 2 * a + 1;
+  }
+
+  _excess.resize(num_nodes);
+  _pi.resize(num_nodes);
+  _dist.resize(num_nodes);
+  _pred.resize(num_nodes);
+  _done.resize(num_nodes);
+}
+
+bool SuccessiveShortestPathSolver::solve(bool /*warm_start*/) {
+  const long INF = numeric_limits<long>::max();
+  typedef pair<long, int> entry_t;
+
+  fill(_flows, _flows + _num_arcs, 0);
+  for (int i = 0; i < _num_nodes; ++i) {
+    _excess[i] = -_demands[i];
+  }
+  // With no flow, the zero potentials are valid, because costs are
+  // non-negative.
+  fill(_pi.begin(), _pi.end(), 0);
+
+  for (;;) {
+    // Shortest paths (with reduced costs) from all surplus nodes at once; stop
+    // at the first deficit node.
+    priority_queue<entry_t, vector<entry_t>, greater<entry_t> > queue;
+    for (int i = 0; i < _num_nodes; ++i) {
+      _pred[i] = -1;
+      _done[i] = false;
+      if (_excess[i] > 0) {
+        _dist[i] = 0;
+        queue.push(make_pair(0L, i));
+      } else {
+        _dist[i] = INF;
+      }
+    }
+    if (queue.empty())
+      break;
+
+    int t = -1;
+    while (!queue.empty()) {
+      entry_t top = queue.top();
+      queue.pop();
+      int u = top.second;
+      if (_done[u])
+        continue;
+      _done[u] = true;
+      if (_excess[u] < 0) {
+        t = u;
+        break;
+      }
+      for (int k = _out_start[u]; k < _out_start[u + 1]; ++k) {
+        int r = _out[k];
+        int a = r / 2;
+        int v, residual;
+        long cost;
+        if (r % 2 == 0) {
+          v = _end_nodes[a] - 1;
+          residual = _capacities[a] - _flows[a];
+          cost = _costs[a];
+        } else {
+          v = _start_nodes[a] - 1;
+          residual = _flows[a];
+          cost = -_costs[a];
+        }
+        if (residual <= 0 || _done[v])
+          continue;
+        long d = top.first + cost + _pi[u] - _pi[v];
+        if (d < _dist[v]) {
+          _dist[v] = d;
+          _pred[v] = r;
+          queue.push(make_pair(d, v));
+        }
+      }
+    }
+    if (t < 0)
+      return false;
+
+    // Keep the reduced costs non-negative on the residual arcs.
+    long dist_t = _dist[t];
+    for (int i = 0; i < _num_nodes; ++i) {
+      _pi[i] += min(_dist[i], dist_t);
+    }
+
+    // Augment by as much as the path, its ends and its arcs allow.
+    int delta = -_excess[t];
+    int s = t;
+    while (_pred[s] >= 0) {
+      int r = _pred[s];
+      int a = r / 2;
+      if (r % 2 == 0) {
+        delta = min(delta, _capacities[a] - _flows[a]);
+        s = _start_nodes[a] - 1;
+      } else {
+        delta = min(delta, _flows[a]);
+        s = _end_nodes[a] - 1;
+      }
+    }
+    delta = min(delta, _excess[s]);
+    ASSERT(delta > 0);
+
+    for (int v = t; _pred[v] >= 0; ) {
+      int r = _pred[v];
+      int a = r / 2;
+      if (r % 2 == 0) {
+        _flows[a] += delta;
+        v = _start_nodes[a] - 1;
+      } else {
+        _flows[a] -= delta;
+        v = _end_nodes[a] - 1;
+      }
+    }
+    _excess[s] -= delta;
+    _excess[t] += delta;
+  }
+
+  // All surpluses are gone; the problem is infeasible if demand remains.
+  for (int i = 0; i < _num_nodes; ++i) {
+    if (_excess[i] != 0)
+      return false;
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,175 @@
+#ifndef SI_TAXI_MIN_COST_FLOW_H_
+#define SI_TAXI_MIN_COST_FLOW_H_
+
+#include "si_taxi.h"
+
+struct relax4_state;
+
+namespace si_taxi {
+
+/**
+ * Interface for minimum cost network flow solvers.
+ *
+ * The problem is given in the same form as for relax4 (see relax4.h): arrays of
+ * start nodes, end nodes, costs and capacities for the arcs, and an array of
+ * demands for the nodes (negative for surplus nodes), with nodes numbered from
+ * one. The arrays belong to the caller; they are not copied, so you can solve
+ * several problems of the same size by changing the capacities and demands
+ * between calls to solve. The arcs and costs must not change after init.
+ *
+ * Note that solvers may overwrite the capacities and demands (relax4 does), so
+ * they must be reset before each call to solve.
+ */
+struct MinCostFlowSolver {
+  virtual ~MinCostFlowSolver() { }
+
+  /**
+   * Set up for problems on the given network; flows receives the solution.
+   */
+  virtual void init(int num_nodes, int num_arcs,
+      int *start_nodes, int *end_nodes, int *costs,
+      int *capacities, int *demands, int *flows) = 0;
+
+  /**
+   * Solve the problem with the current capacities and demands.
+   *
+   * @param warm_start if true, the solver may start from its solution to the
+   * previous problem; solvers that cannot do this ignore it
+   *
+   * @return true if an optimal flow was found; false if the problem is
+   * infeasible
+   */
+  virtual bool solve(bool warm_start=false) = 0;
+};
+
+/**
+ * The available MinCostFlowSolver implementations.
+ */
+enum MinCostFlowSolverType {
+  /// see Relax4Solver
+  MIN_COST_FLOW_RELAX4,
+  /// see NetworkSimplexSolver
+  MIN_COST_FLOW_NETWORK_SIMPLEX,
+  /// see SuccessiveShortestPathSolver
+  MIN_COST_FLOW_SUCCESSIVE_SHORTEST_PATH
+};
+
+/**
+ * Create a solver of the given type; the caller must delete it.
+ */
+MinCostFlowSolver *new_min_cost_flow_solver(MinCostFlowSolverType type);
+
+/**
+ * The RELAX4 relaxation method of Bertsekas and Tseng (see relax4.h). Supports
+ * warm starts (see relax4_init_warm).
+ */
+struct Relax4Solver : public MinCostFlowSolver {
+  Relax4Solver() : _state(NULL), _have_prices(false) { }
+  virtual ~Relax4Solver();
+
+  virtual void init(int num_nodes, int num_arcs,
+      int *start_nodes, int *end_nodes, int *costs,
+      int *capacities, int *demands, int *flows);
+
+  virtual bool solve(bool warm_start=false);
+
+private:
+  relax4_state *_state;
+  /// true once relax4_run has been called, so relax4_init_warm can be used
+  bool _have_prices;
+};
+
+/**
+ * Primal network simplex with an artificial root node and block search
+ * pricing. Each solve starts from the artificial basis, so warm_start is
+ * ignored.
+ */
+struct NetworkSimplexSolver : public MinCostFlowSolver {
+  NetworkSimplexSolver() : _num_nodes(0), _num_arcs(0) { }
+
+  virtual void init(int num_nodes, int num_arcs,
+      int *start_nodes, int *end_nodes, int *costs,
+      int *capacities, int *demands, int *flows);
+
+  virtual bool solve(bool warm_start=false);
+
+private:
+  /// Find the entering arc; returns false if the flow is optimal.
+  bool find_entering_arc();
+  /// Update flows and the spanning tree for the entering arc.
+  void pivot();
+  /// Recompute depths and potentials from the parent pointers.
+  void update_tree();
+
+  int _num_nodes;
+  int _num_arcs;
+  int *_start_nodes;
+  int *_end_nodes;
+  int *_costs;
+  int *_capacities;
+  int *_demands;
+  int *_flows;
+
+  // The arrays below include one artificial arc per node (after the real
+  // arcs) and the artificial root node (after the real nodes); nodes are
+  // numbered from zero.
+  std::vector<int> _source;
+  std::vector<int> _target;
+  std::vector<long> _cost;
+  std::vector<int> _cap;
+  std::vector<int> _flow;
+  /// -1 for arcs at their upper bound, 0 in the tree, 1 at their lower bound
+  std::vector<int> _state;
+  std::vector<int> _parent;
+  std::vector<int> _pred;
+  std::vector<int> _depth;
+  std::vector<long> _pi;
+  std::vector<int> _order;
+  std::vector<int> _child_start;
+  std::vector<int> _children;
+  int _in_arc;
+  int _next_arc;
+  int _block_size;
+};
+
+/**
+ * Successive shortest paths with Dijkstra's algorithm and node potentials,
+ * starting from all surplus nodes at once. Arc costs must be non-negative, as
+ * they are in transportation problems like the one that
+ * BWDynamicTransportationProblemHandler builds. The number of iterations is at
+ * most the total surplus, so it is fast when there are few vehicles to move.
+ * Each solve starts from zero flow, so warm_start is ignored.
+ */
+struct SuccessiveShortestPathSolver : public MinCostFlowSolver {
+  SuccessiveShortestPathSolver() : _num_nodes(0), _num_arcs(0) { }
+
+  virtual void init(int num_nodes, int num_arcs,
+      int *start_nodes, int *end_nodes, int *costs,
+      int *capacities, int *demands, int *flows);
+
+  virtual bool solve(bool warm_start=false);
+
+private:
+  int _num_nodes;
+  int _num_arcs;
+  int *_start_nodes;
+  int *_end_nodes;
+  int *_costs;
+  int *_capacities;
+  int *_demands;
+  int *_flows;
+
+  /// residual arcs out of node i are _out[_out_start[i] .. _out_start[i+1]);
+  /// each is 2a for the forward arc a or 2a+1 for its reverse
+  std::vector<int> _out_start;
+  std::vector<int> _out;
+  std::vector<int> _excess;
+  std::vector<long> _pi;
+  std::vector<long> _dist;
+  std::vector<int> _pred;
+  std::vector<char> _done;
+};
+
+}
+
+#endif // guard
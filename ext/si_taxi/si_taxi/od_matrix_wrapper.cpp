@@ -11,7 +11,8 @@ using namespace std;
 namespace si_taxi {
 
 ODMatrixWrapper::ODMatrixWrapper(
-    const boost::numeric::ublas::matrix<double> &od) : _od(od) {
+    const boost::numeric::ublas::matrix<double> &od,
+    EmpiricalSamplerMethod method) : _od(od) {
   CHECK(_od.size1() == _od.size2());
   size_t n = _od.size1();
   boost::numeric::ublas::scalar_vector<double> ones(n);
@@ -22,11 +23,12 @@ ODMatrixWrapper::ODMatrixWrapper(
 
   // flatten the matrix for more efficient sampling; the sampling step is a
   // performance hot spot for (surprise) the sampling and voting algorithm;
-  // partial_sum is cumsum (cumulative sum)
+  // partial_sum is cumsum (cumulative sum); the alias method avoids the
+  // binary search altogether
   vector<double> cdf(_trip_prob.data().size());
   std::partial_sum(_trip_prob.data().begin(), _trip_prob.data().end(),
       cdf.begin());
-  _sampler = EmpiricalSampler(cdf);
+  _sampler = EmpiricalSampler(cdf, 1e-5, method);
 }
 
 // Boost's Poisson distribution doesn't like a zero rate.
@@ -105,18 +107,57 @@ double ODMatrixWrapper::multinomial_trip_pmf(size_t i, const std::vector<int> &x
 
 void ODMatrixWrapper::sample(size_t &origin, size_t &destin,
     double &interval) const {
+  sample(origin, destin, interval, si_taxi::rng);
+}
+
+void ODMatrixWrapper::sample(size_t &origin, size_t &destin,
+    double &interval, RNG &rng) const {
   // Having 64-bit portability problems with variate_generator and
   // exponential_distribution, so I am just doing this manually for now.
   // JLM 20100425
-  double u = genrand_c01o<double>(si_taxi::rng);
+  double u = genrand_c01o<double>(rng);
   interval = -log(1 - u) * _expected_interarrival_time;
 
   size_t n = _od.size1();
-  size_t l = _sampler.sample();
+  size_t l = _sampler.sample(rng);
   origin = l / n;
   destin = l % n;
   ASSERT(origin < n);
   ASSERT(origin != destin);
 }
 
+void ODMatrixWrapper::sample_batch(size_t num_requests, size_t *origins,
+    size_t *destins, double *intervals, RNG &rng) const {
+  // Draw the random numbers in the same order as sample does; the draws for
+  // the origins and destinations are kept in destins until the last pass.
+  for (size_t r = 0; r < num_requests; ++r) {
+    intervals[r] = genrand_c01o<double>(rng);
+    destins[r] = rng();
+  }
+
+  for (size_t r = 0; r < num_requests; ++r) {
+    intervals[r] = -log(1 - intervals[r]) * _expected_interarrival_time;
+  }
+
+  size_t n = _od.size1();
+  for (size_t r = 0; r < num_requests; ++r) {
+    size_t l = _sampler.pick_uniform(
+        destins[r] * (1.0 / 4294967296.0)); // as in genrand_c01o
+    origins[r] = l / n;
+    destins[r] = l % n;
+    ASSERT(origins[r] < n);
+    ASSERT(origins[r] != destins[r]);
+  }
+}
+
+void ODSampleBuffer::refill(const ODMatrixWrapper &od, size_t batch_size,
+    RNG &rng) {
+  CHECK(batch_size > 0);
+  _origins.resize(batch_size);
+  _destins.resize(batch_size);
+  _intervals.resize(batch_size);
+  od.sample_batch(batch_size, &_origins[0], &_destins[0], &_intervals[0], rng);
+  _next = 0;
+}
+
 }
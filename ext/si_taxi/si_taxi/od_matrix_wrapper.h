@@ -17,7 +17,13 @@ namespace si_taxi {
  */
 struct ODMatrixWrapper
 {
-  ODMatrixWrapper(const boost::numeric::ublas::matrix<double> &od);
+  /**
+   * @param od demand matrix
+   * @param method used by sample to pick the origin and destination; see
+   *        EmpiricalSamplerMethod
+   */
+  ODMatrixWrapper(const boost::numeric::ublas::matrix<double> &od,
+      EmpiricalSamplerMethod method=EMPIRICAL_SAMPLER_BINARY_SEARCH);
 
   inline size_t num_stations() const {
     return _od.size1();
@@ -121,6 +127,34 @@ struct ODMatrixWrapper
    */
   void sample(size_t &origin, size_t &destin, double &interval) const;
 
+  /**
+   * As sample(origin, destin, interval), but using the given generator instead
+   * of si_taxi::rng.
+   */
+  void sample(size_t &origin, size_t &destin, double &interval,
+      RNG &rng) const;
+
+  /**
+   * Generate num_requests requests into the given arrays. The results are the
+   * same as for num_requests calls to sample with the same generator, but
+   * the random numbers, the intervals and the origins and destinations are
+   * each computed in their own pass over the arrays, which gives the compiler
+   * simple loops to optimise.
+   *
+   * @param origins [out] num_requests entries
+   * @param destins [out] num_requests entries
+   * @param intervals [out] num_requests entries
+   */
+  void sample_batch(size_t num_requests, size_t *origins, size_t *destins,
+      double *intervals, RNG &rng) const;
+
+  /**
+   * See constructor.
+   */
+  inline EmpiricalSamplerMethod sampler_method() const {
+    return _sampler.method();
+  }
+
 private:
   boost::numeric::ublas::matrix<double> _od;
   double _expected_interarrival_time;
@@ -130,6 +164,46 @@ private:
   EmpiricalSampler _sampler;
 };
 
+/**
+ * Requests generated in batches by ODMatrixWrapper::sample_batch and handed
+ * out one at a time; this is how the Poisson passenger streams generate
+ * requests in chunks.
+ */
+struct ODSampleBuffer
+{
+  ODSampleBuffer() : _next(0) { }
+
+  /**
+   * Take the next request, as for ODMatrixWrapper::sample, generating
+   * batch_size more if the buffer is empty.
+   */
+  inline void sample(const ODMatrixWrapper &od, size_t batch_size,
+      size_t &origin, size_t &destin, double &interval, RNG &rng) {
+    if (_next == _intervals.size()) {
+      refill(od, batch_size, rng);
+    }
+    origin = _origins[_next];
+    destin = _destins[_next];
+    interval = _intervals[_next];
+    ++_next;
+  }
+
+  /**
+   * Discard the requests in the buffer.
+   */
+  inline void clear() {
+    _next = _intervals.size();
+  }
+
+private:
+  void refill(const ODMatrixWrapper &od, size_t batch_size, RNG &rng);
+
+  std::vector<size_t> _origins;
+  std::vector<size_t> _destins;
+  std::vector<double> _intervals;
+  size_t _next;
+};
+
 }
 
 #endif // guard
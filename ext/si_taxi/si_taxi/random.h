@@ -4,8 +4,8 @@
 /**
  * Helpful methods for generating random numbers.
  *
- * The template parameter RNG should be something like the boost::mt19937
- * random number generator.
+ * The template parameter RNG should be something like si_taxi::RNG or the
+ * boost::mt19937 random number generator.
  */
 
 namespace si_taxi {
@@ -10,6 +10,9 @@
  * node-length array, but it was indexed by the 'nb' variable, which can become
  * larger than the number of nodes. The prdcsr array is now as long as the max
  * of the number of arcs and the number of nodes.
+ * 3) The common blocks are now members of a relax4_state, which is passed to
+ * every routine, and local variables are no longer static, so the code is
+ * reentrant.
  *
  * The f2c linkage dependencies have been removed, but the FORTRAN character of
  * the code has been largely preserved -- you have been warned.
@@ -43,293 +46,274 @@ typedef char logical1;
  * Common Block Declarations
  */
 
-struct {
-  RELAX4_INT n, na, large;
-} input_;
-
-#define input_1 input_
-
-struct {
-  RELAX4_INT *startn;
-} arrays_;
-
-#define arrays_1 arrays_
-
-struct {
-  RELAX4_INT *endn;
-} arraye_;
-
-#define arraye_1 arraye_
-
-struct {
-  RELAX4_INT *c__;
-} arrayc_;
-
-#define arrayc_1 arrayc_
-
-struct {
-  RELAX4_INT *u;
-} arrayu_;
-
-#define arrayu_1 arrayu_
-
-union {
-  struct {
-    RELAX4_INT *b;
-  } _1;
-  struct {
-    RELAX4_INT *dfct;
-  } _2;
-} arrayb_;
-
-#define arrayb_1 (arrayb_._1)
-#define arrayb_2 (arrayb_._2)
-
-struct {
-  RELAX4_INT *x;
-} arrayx_;
-
-#define arrayx_1 arrayx_
-
-struct {
-  RELAX4_INT *rc;
-} arrayrc_;
-
-#define arrayrc_1 arrayrc_
-
-struct {
-  RELAX4_INT nmultinode, iter, num_augm__, num_ascnt__, nsp;
-} output_;
-
-#define output_1 output_
-
-union {
-  struct {
-    RELAX4_INT *i1;
-  } _1;
-  struct {
-    RELAX4_INT *tempin;
-  } _2;
-  struct {
-    RELAX4_INT *label;
-  } _3;
-  struct {
-    RELAX4_INT *p;
-  } _4;
-} blk1_;
-
-#define blk1_1 (blk1_._1)
-#define blk1_2 (blk1_._2)
-#define blk1_3 (blk1_._3)
-#define blk1_4 (blk1_._4)
-
-union {
-  struct {
-    RELAX4_INT *i2;
-  } _1;
-  struct {
-    RELAX4_INT *tempou;
-  } _2;
-  struct {
-    RELAX4_INT *prdcsr;
-  } _3;
-  struct {
-    RELAX4_INT *price;
-  } _4;
-} blk2_;
-
-#define blk2_1 (blk2_._1)
-#define blk2_2 (blk2_._2)
-#define blk2_3 (blk2_._3)
-#define blk2_4 (blk2_._4)
-
-union {
-  struct {
-    RELAX4_INT *i3;
-  } _1;
-  struct {
-    RELAX4_INT *fou;
-  } _2;
-} blk3_;
-
-#define blk3_1 (blk3_._1)
-#define blk3_2 (blk3_._2)
-
-union {
-  struct {
-    RELAX4_INT *i4;
-  } _1;
-  struct {
-    RELAX4_INT *nxtou;
-  } _2;
-} blk4_;
-
-#define blk4_1 (blk4_._1)
-#define blk4_2 (blk4_._2)
-
-union {
-  struct {
-    RELAX4_INT *i5;
-  } _1;
-  struct {
-    RELAX4_INT *fin;
-  } _2;
-} blk5_;
-
-#define blk5_1 (blk5_._1)
-#define blk5_2 (blk5_._2)
-
-union {
-  struct {
-    RELAX4_INT *i6;
-  } _1;
-  struct {
-    RELAX4_INT *nxtin;
-  } _2;
-} blk6_;
-
-#define blk6_1 (blk6_._1)
-#define blk6_2 (blk6_._2)
-
-union {
-  struct {
-    RELAX4_INT *i7;
-  } _1;
+/*
+ * The common blocks are kept in a relax4_state, so that several problems can
+ * be solved at once; each routine takes the state as its first argument, and
+ * the following macros give the common block names in terms of it.
+ */
+struct relax4_state {
   struct {
-    RELAX4_INT *save;
-  } _2;
-} blk7_;
+    RELAX4_INT n, na, large;
+  } input_;
 
-#define blk7_1 (blk7_._1)
-#define blk7_2 (blk7_._2)
-
-struct {
-  logical1 *scan;
-} blk8_;
-
-#define blk8_1 blk8_
-
-union {
-  struct {
-    logical1 *mark;
-  } _1;
   struct {
-    logical1 *path_id__;
-  } _2;
-} blk9_;
+    RELAX4_INT *startn;
+  } arrays_;
 
-#define blk9_1 (blk9_._1)
-#define blk9_2 (blk9_._2)
-
-union {
-  struct {
-    RELAX4_INT *tfstou; /* AKA ddpos */
-  } _1;
   struct {
-    RELAX4_INT *fpushf;
-  } _2;
-} blk10_;
-
-#define blk10_1 (blk10_._1)
-#define blk10_2 (blk10_._2)
+    RELAX4_INT *endn;
+  } arraye_;
 
-union {
   struct {
-    RELAX4_INT *tnxtou;
-  } _1;
-  struct {
-    RELAX4_INT *nxtpushf;
-  } _2;
-} blk11_;
-
-#define blk11_1 (blk11_._1)
-#define blk11_2 (blk11_._2)
+    RELAX4_INT *c__;
+  } arrayc_;
 
-union {
   struct {
-    RELAX4_INT *tfstin; /* AKA ddneg */
-  } _1;
-  struct {
-    RELAX4_INT *fpushb;
-  } _2;
-} blk12_;
-
-#define blk12_1 (blk12_._1)
-#define blk12_2 (blk12_._2)
+    RELAX4_INT *u;
+  } arrayu_;
+
+  union {
+    struct {
+      RELAX4_INT *b;
+    } _1;
+    struct {
+      RELAX4_INT *dfct;
+    } _2;
+  } arrayb_;
 
-union {
   struct {
-    RELAX4_INT *tnxtin;
-  } _1;
-  struct {
-    RELAX4_INT *nxtpushb;
-  } _2;
-} blk13_;
-
-#define blk13_1 (blk13_._1)
-#define blk13_2 (blk13_._2)
+    RELAX4_INT *x;
+  } arrayx_;
 
-union {
   struct {
-    RELAX4_INT *i14;
-  } _1;
-  struct {
-    RELAX4_INT *nxtqueue;
-  } _2;
-} blk14_;
-
-#define blk14_1 (blk14_._1)
-#define blk14_2 (blk14_._2)
+    RELAX4_INT *rc;
+  } arrayrc_;
 
-union {
   struct {
-    RELAX4_INT *i15;
-  } _1;
-  struct {
-    RELAX4_INT *extend_arc__;
-  } _2;
-} blk15_;
-
-#define blk15_1 (blk15_._1)
-#define blk15_2 (blk15_._2)
+    RELAX4_INT nmultinode, iter, num_augm__, num_ascnt__, nsp;
+  } output_;
+
+  union {
+    struct {
+      RELAX4_INT *i1;
+    } _1;
+    struct {
+      RELAX4_INT *tempin;
+    } _2;
+    struct {
+      RELAX4_INT *label;
+    } _3;
+    struct {
+      RELAX4_INT *p;
+    } _4;
+  } blk1_;
+
+  union {
+    struct {
+      RELAX4_INT *i2;
+    } _1;
+    struct {
+      RELAX4_INT *tempou;
+    } _2;
+    struct {
+      RELAX4_INT *prdcsr;
+    } _3;
+    struct {
+      RELAX4_INT *price;
+    } _4;
+  } blk2_;
+
+  union {
+    struct {
+      RELAX4_INT *i3;
+    } _1;
+    struct {
+      RELAX4_INT *fou;
+    } _2;
+  } blk3_;
+
+  union {
+    struct {
+      RELAX4_INT *i4;
+    } _1;
+    struct {
+      RELAX4_INT *nxtou;
+    } _2;
+  } blk4_;
+
+  union {
+    struct {
+      RELAX4_INT *i5;
+    } _1;
+    struct {
+      RELAX4_INT *fin;
+    } _2;
+  } blk5_;
+
+  union {
+    struct {
+      RELAX4_INT *i6;
+    } _1;
+    struct {
+      RELAX4_INT *nxtin;
+    } _2;
+  } blk6_;
+
+  union {
+    struct {
+      RELAX4_INT *i7;
+    } _1;
+    struct {
+      RELAX4_INT *save;
+    } _2;
+  } blk7_;
 
-union {
   struct {
-    RELAX4_INT *i16;
-  } _1;
-  struct {
-    RELAX4_INT *sb_level__;
-  } _2;
-} blk16_;
-
-#define blk16_1 (blk16_._1)
-#define blk16_2 (blk16_._2)
+    logical1 *scan;
+  } blk8_;
+
+  union {
+    struct {
+      logical1 *mark;
+    } _1;
+    struct {
+      logical1 *path_id__;
+    } _2;
+  } blk9_;
+
+  union {
+    struct {
+      RELAX4_INT *tfstou; /* AKA ddpos */
+    } _1;
+    struct {
+      RELAX4_INT *fpushf;
+    } _2;
+  } blk10_;
+
+  union {
+    struct {
+      RELAX4_INT *tnxtou;
+    } _1;
+    struct {
+      RELAX4_INT *nxtpushf;
+    } _2;
+  } blk11_;
+
+  union {
+    struct {
+      RELAX4_INT *tfstin; /* AKA ddneg */
+    } _1;
+    struct {
+      RELAX4_INT *fpushb;
+    } _2;
+  } blk12_;
+
+  union {
+    struct {
+      RELAX4_INT *tnxtin;
+    } _1;
+    struct {
+      RELAX4_INT *nxtpushb;
+    } _2;
+  } blk13_;
+
+  union {
+    struct {
+      RELAX4_INT *i14;
+    } _1;
+    struct {
+      RELAX4_INT *nxtqueue;
+    } _2;
+  } blk14_;
+
+  union {
+    struct {
+      RELAX4_INT *i15;
+    } _1;
+    struct {
+      RELAX4_INT *extend_arc__;
+    } _2;
+  } blk15_;
+
+  union {
+    struct {
+      RELAX4_INT *i16;
+    } _1;
+    struct {
+      RELAX4_INT *sb_level__;
+    } _2;
+  } blk16_;
+
+  union {
+    struct {
+      RELAX4_INT *i17;
+    } _1;
+    struct {
+      RELAX4_INT *sb_arc__;
+    } _2;
+  } blk17_;
 
-union {
   struct {
-    RELAX4_INT *i17;
-  } _1;
-  struct {
-    RELAX4_INT *sb_arc__;
-  } _2;
-} blk17_;
-
-#define blk17_1 (blk17_._1)
-#define blk17_2 (blk17_._2)
-
-struct {
-  RELAX4_INT crash;
-} cr_;
-
-#define cr_1 cr_
-
-/* Subroutine */ int inidat_(void)
+    RELAX4_INT crash;
+  } cr_;
+};
+
+#define input_1 (state->input_)
+#define arrays_1 (state->arrays_)
+#define arraye_1 (state->arraye_)
+#define arrayc_1 (state->arrayc_)
+#define arrayu_1 (state->arrayu_)
+#define arrayb_1 (state->arrayb_._1)
+#define arrayb_2 (state->arrayb_._2)
+#define arrayx_1 (state->arrayx_)
+#define arrayrc_1 (state->arrayrc_)
+#define output_1 (state->output_)
+#define blk1_1 (state->blk1_._1)
+#define blk1_2 (state->blk1_._2)
+#define blk1_3 (state->blk1_._3)
+#define blk1_4 (state->blk1_._4)
+#define blk2_1 (state->blk2_._1)
+#define blk2_2 (state->blk2_._2)
+#define blk2_3 (state->blk2_._3)
+#define blk2_4 (state->blk2_._4)
+#define blk3_1 (state->blk3_._1)
+#define blk3_2 (state->blk3_._2)
+#define blk4_1 (state->blk4_._1)
+#define blk4_2 (state->blk4_._2)
+#define blk5_1 (state->blk5_._1)
+#define blk5_2 (state->blk5_._2)
+#define blk6_1 (state->blk6_._1)
+#define blk6_2 (state->blk6_._2)
+#define blk7_1 (state->blk7_._1)
+#define blk7_2 (state->blk7_._2)
+#define blk8_1 (state->blk8_)
+#define blk9_1 (state->blk9_._1)
+#define blk9_2 (state->blk9_._2)
+#define blk10_1 (state->blk10_._1)
+#define blk10_2 (state->blk10_._2)
+#define blk11_1 (state->blk11_._1)
+#define blk11_2 (state->blk11_._2)
+#define blk12_1 (state->blk12_._1)
+#define blk12_2 (state->blk12_._2)
+#define blk13_1 (state->blk13_._1)
+#define blk13_2 (state->blk13_._2)
+#define blk14_1 (state->blk14_._1)
+#define blk14_2 (state->blk14_._2)
+#define blk15_1 (state->blk15_._1)
+#define blk15_2 (state->blk15_._2)
+#define blk16_1 (state->blk16_._1)
+#define blk16_2 (state->blk16_._2)
+#define blk17_1 (state->blk17_._1)
+#define blk17_2 (state->blk17_._2)
+#define cr_1 (state->cr_)
+
+/* Subroutine */ static int inidat_(relax4_state *state)
 {
   /* System generated locals */
   RELAX4_INT i__1;
 
   /* Local variables */
-  static RELAX4_INT i__, i1, i2;
+  RELAX4_INT i__, i1, i2;
 
 
   /* --------------------------------------------------------------- */
@@ -412,13 +396,13 @@ struct {
 * ARC SATISFY COMPLEMENTARY SLACKNESS AND THE DFCT ARRAY PROPERLY CORRESPOND TO
 * THE INITIAL ARC/FLOWS.
 */
-int relax4_init_phase_1(void) {
+static int tighten_(relax4_state *state) {
 
   RELAX4_INT i__1, i__2;
   RELAX4_INT node, arc, node_def__, maxcap, scapou, scapin, capout, capin;
 
   /* CONSTRUCT LINKED LISTS FOR THE PROBLEM */
-  inidat_();
+  inidat_(state);
 
   i__1 = input_1.n;
   for (node = 1; node <= i__1; ++node) {
@@ -489,6 +473,16 @@ L10:
     ;
   }
 
+  return RELAX4_OK;
+}
+
+int relax4_init_phase_1(relax4_state *state) {
+  RELAX4_INT arc;
+
+  if (tighten_(state) != RELAX4_OK) {
+    return RELAX4_INFEASIBLE;
+  }
+
   /* INITIALIZE DUAL PRICES */
   /* (DEFAULT: ALL DUAL PRICES = 0, SO REDUCED COST IS SET EQUAL TO COST) */
   for (arc = 1; arc <= input_1.na; ++arc) {
@@ -504,7 +498,7 @@ L10:
 /* THESE TWO ALWAYS ADD UP TO THE TOTAL CAPACITY FOR ARC. */
 /* ALSO COMPUTE THE DIRECTIONAL DERIVATIVES FOR EACH COORDINATE */
 /* AND COMPUTE THE ACTUAL DEFICITS. */
-int relax4_init_phase_2(void) {
+int relax4_init_phase_2(relax4_state *state) {
   RELAX4_INT i__1, i__2;
   RELAX4_INT numpasses, node, arc, t, t1, t2, passes, delprc, trc, nxtbrk; 
 
@@ -832,34 +826,68 @@ L40:
   return RELAX4_OK;
 }
 
-/* Subroutine */ int relax4_(void)
+/*
+ * Warm start (JLM): this is the REPEAT option described above. Keep the
+ * reduced costs from the last call to relax4_, tighten the (new) capacities as
+ * in phase 1, and choose flows that satisfy complementary slackness with the
+ * old reduced costs, keeping the old flows on balanced arcs where possible.
+ * The deficits are then computed from the new demands and these flows.
+ */
+int relax4_init_warm(relax4_state *state) {
+  RELAX4_INT arc, t, x;
+
+  if (tighten_(state) != RELAX4_OK) {
+    return RELAX4_INFEASIBLE;
+  }
+
+  for (arc = 1; arc <= input_1.na; ++arc) {
+    t = arrayu_1.u[arc - 1];
+    if (arrayrc_1.rc[arc - 1] < 0) {
+      x = t;
+    } else if (arrayrc_1.rc[arc - 1] > 0) {
+      x = 0;
+    } else {
+      x = min(arrayx_1.x[arc - 1], t);
+    }
+    arrayx_1.x[arc - 1] = x;
+    arrayu_1.u[arc - 1] = t - x;
+    arrayb_2.dfct[arrays_1.startn[arc - 1] - 1] += x;
+    arrayb_2.dfct[arraye_1.endn[arc - 1] - 1] -= x;
+  }
+
+  return RELAX4_OK;
+}
+
+/* Forward declarations. */
+static int ascnt1_(relax4_state *, RELAX4_INT *, RELAX4_INT *, RELAX4_INT *,
+    logical1 *, logical1 *, RELAX4_INT *, RELAX4_INT *, RELAX4_INT *);
+static int ascnt2_(relax4_state *, RELAX4_INT *, RELAX4_INT *, RELAX4_INT *,
+    logical1 *, logical1 *, RELAX4_INT *, RELAX4_INT *, RELAX4_INT *);
+
+/* Subroutine */ static int relax4_(relax4_state *state)
 {
   /* System generated locals */
   RELAX4_INT i__1, i__2, i__3;
 
   /* Local variables */
-  static RELAX4_INT prevnode, i__, j, t1, t2, lastqueue, 
+  RELAX4_INT prevnode, i__, j, t1, t2, lastqueue, 
                  numnz_new__, ib, nb, dp, dm, dx, tp, ts, num_passes__, 
                  arc;
-  static RELAX4_INT narc, node, delx;
-  static logical1 quit;
-  static RELAX4_INT node2;
-  static RELAX4_INT indef;
-  static RELAX4_INT nscan;
-  static logical1 posit;
-  static RELAX4_INT numnz;
-  extern /* Subroutine */ int ascnt1_(RELAX4_INT *, RELAX4_INT *, RELAX4_INT *, 
-      logical1 *, logical1 *, RELAX4_INT *, RELAX4_INT *, RELAX4_INT *), ascnt2_(
-        RELAX4_INT *, RELAX4_INT *, RELAX4_INT *, logical1 *, logical1 *, RELAX4_INT *
-        , RELAX4_INT *, RELAX4_INT *);
-  static logical1 feasbl;
-  static RELAX4_INT nlabel, defcit, delprc, augnod, tmparc, 
+  RELAX4_INT narc, node, delx;
+  logical1 quit;
+  RELAX4_INT node2;
+  RELAX4_INT indef;
+  RELAX4_INT nscan;
+  logical1 posit;
+  RELAX4_INT numnz;
+  logical1 feasbl;
+  RELAX4_INT nlabel, defcit, delprc, augnod, tmparc, 
                  rdcost, nxtarc;
-  static logical1 switch__;
-  static RELAX4_INT prvarc;
-  static logical1 pchange;
-  static RELAX4_INT naugnod;
-  static RELAX4_INT nxtnode;
+  logical1 switch__;
+  RELAX4_INT prvarc;
+  logical1 pchange;
+  RELAX4_INT naugnod;
+  RELAX4_INT nxtnode;
 
   /* --------------------------------------------------------------- */
 
@@ -1986,11 +2014,11 @@ L4521:
   /* SO WE CONTINUE LABELING NODES. */
 
   if (posit) {
-    ascnt1_(&dm, &delx, &nlabel, &feasbl, &switch__, &nscan, &node, &
+    ascnt1_(state, &dm, &delx, &nlabel, &feasbl, &switch__, &nscan, &node, &
         prevnode);
     ++output_1.num_ascnt__;
   } else {
-    ascnt2_(&dm, &delx, &nlabel, &feasbl, &switch__, &nscan, &node, &
+    ascnt2_(state, &dm, &delx, &nlabel, &feasbl, &switch__, &nscan, &node, &
         prevnode);
     ++output_1.num_ascnt__;
   }
@@ -2171,18 +2199,24 @@ L4400:
 #undef ddneg
 
 
-/* Subroutine */ int auction_(void)
+/* Subroutine */ static int auction_(relax4_state *state)
 {
   /* System generated locals */
   RELAX4_INT i__1;
 
   /* Local variables */
-  static RELAX4_INT seclevel, red_cost__, bstlevel, prevnode, i__, new_level__,
+  RELAX4_INT seclevel, red_cost__, bstlevel, prevnode, i__, new_level__,
                  prevlevel, lastqueue, num_passes__, arc, end, nas, prd, eps, 
                  thresh_dfct__, node, pend, naug, incr, last, pass, term, flow, 
                  root, resid, pterm, start, secarc, factor, extarc, rdcost, nolist,
                  pstart, prevarc, pr_term__, mincost, maxcost, nxtnode;
 
+  /* These were static (so zero on the first call); they can be read before
+   * they are set if a node has no suitable arcs. */
+  extarc = 0;
+  secarc = 0;
+  last = 0;
+
   /* --------------------------------------------------------------- */
 
   /*  PURPOSE - THIS SUBROUTINE USES A VERSION OF THE AUCTION */
@@ -3024,7 +3058,7 @@ L3000:
 
 
 
-/* Subroutine */ int ascnt1_(RELAX4_INT *dm, RELAX4_INT *delx, RELAX4_INT *nlabel, 
+/* Subroutine */ static int ascnt1_(relax4_state *state, RELAX4_INT *dm, RELAX4_INT *delx, RELAX4_INT *nlabel, 
     logical1 *feasbl, logical1 *switch__, RELAX4_INT *nscan, RELAX4_INT *
     curnode, RELAX4_INT *prevnode)
 {
@@ -3032,7 +3066,7 @@ L3000:
   RELAX4_INT i__1;
 
   /* Local variables */
-  static RELAX4_INT i__, j, t1, t2, t3, nb, arc, dlx, node, node2, nsave, 
+  RELAX4_INT i__, j, t1, t2, t3, nb, arc, dlx, node, node2, nsave, 
                  delprc, rdcost;
 
 
@@ -3421,7 +3455,7 @@ L4:
 
 
 
-/* Subroutine */ int ascnt2_(RELAX4_INT *dm, RELAX4_INT *delx, RELAX4_INT *nlabel, 
+/* Subroutine */ static int ascnt2_(relax4_state *state, RELAX4_INT *dm, RELAX4_INT *delx, RELAX4_INT *nlabel, 
     logical1 *feasbl, logical1 *switch__, RELAX4_INT *nscan, RELAX4_INT *
     curnode, RELAX4_INT *prevnode)
 {
@@ -3429,7 +3463,7 @@ L4:
   RELAX4_INT i__1;
 
   /* Local variables */
-  static RELAX4_INT i__, j, t1, t2, t3, nb, arc, dlx, node, node2, nsave, 
+  RELAX4_INT i__, j, t1, t2, t3, nb, arc, dlx, node, node2, nsave, 
                  delprc, rdcost;
 
 
@@ -3718,52 +3752,8 @@ L4:
   return 0;
 } /* ascnt2_ */
 
-/* Subroutine */ int addtr_(RELAX4_INT *arc)
-{
-  static RELAX4_INT arc1, node;
-
-
-  /* --------------------------------------------------------------- */
-
-  /*  PURPOSE - THIS SUBROUTINE CHECKS IF ARC IS IN THE ARRAYS TFSTOU, TNXTOU, */
-  /*     TFSTIN, TNXTIN AND, IF NOT, ADDS ARC TO THEM. */
-
-  /* --------------------------------------------------------------- */
-
-  /*     MAXNN = DIMENSION OF NODE-LENGTH ARRAYS */
-  /*     MAXNA = DIMENSION OF ARC-LENGTH ARRAYS */
-
-
-
-  node = arrays_1.startn[*arc - 1];
-  arc1 = blk10_1.tfstou[node - 1];
-L10:
-  if (arc1 > 0) {
-    if (arc1 == *arc) {
-      goto L20;
-    }
-    arc1 = blk11_1.tnxtou[arc1 - 1];
-    goto L10;
-  }
-  blk11_1.tnxtou[*arc - 1] = blk10_1.tfstou[node - 1];
-  blk10_1.tfstou[node - 1] = *arc;
-L20:
-  node = arraye_1.endn[*arc - 1];
-  arc1 = blk12_1.tfstin[node - 1];
-L30:
-  if (arc1 > 0) {
-    if (arc1 == *arc) {
-      return 0;
-    }
-    arc1 = blk13_1.tnxtin[arc1 - 1];
-    goto L30;
-  }
-  blk13_1.tnxtin[*arc - 1] = blk12_1.tfstin[node - 1];
-  blk12_1.tfstin[node - 1] = *arc;
-  return 0;
-} /* addtr_ */
-
-int relax4_init(RELAX4_INT num_nodes, RELAX4_INT num_arcs,
+int relax4_init(relax4_state **state_out,
+    RELAX4_INT num_nodes, RELAX4_INT num_arcs,
     RELAX4_INT start_nodes[],
     RELAX4_INT end_nodes[],
     RELAX4_INT costs[],
@@ -3772,6 +3762,14 @@ int relax4_init(RELAX4_INT num_nodes, RELAX4_INT num_arcs,
     RELAX4_INT flows[],
     RELAX4_INT large)
 {
+  relax4_state *state;
+
+  *state_out = NULL;
+  state = calloc(1, sizeof(relax4_state));
+  if (state == NULL) {
+    return RELAX4_FAIL_OUT_OF_MEMORY;
+  }
+
   /* Set input/output pointers. */
   input_1.n = num_nodes;
   input_1.na = num_arcs;
@@ -3844,14 +3842,15 @@ int relax4_init(RELAX4_INT num_nodes, RELAX4_INT num_arcs,
       blk15_1.i15 == NULL ||
       blk16_1.i16 == NULL ||
       blk17_1.i17 == NULL) {
-    relax4_free();
+    relax4_free(state);
     return RELAX4_FAIL_OUT_OF_MEMORY;
   }
 
+  *state_out = state;
   return RELAX4_OK;
 }
 
-int relax4_check_inputs(int max_cost)
+int relax4_check_inputs(relax4_state *state, int max_cost)
 {
   RELAX4_INT i;
 
@@ -3886,20 +3885,20 @@ int relax4_check_inputs(int max_cost)
   return RELAX4_OK;
 }
 
-int relax4_auction() 
+int relax4_auction(relax4_state *state)
 {
   /* SET CRASH EQUAL TO 1 TO ACTIVATE AN AUCTION/SHORTEST PATH SUBROUTINE FOR */
   /* GETTING THE INITIAL PRICE-FLOW PAIR. THIS IS RECOMMENDED FOR DIFFICULT */
   /* PROBLEMS WHERE THE DEFAULT INITIALIZATION YIELDS LONG SOLUTION TIMES. */
   cr_1.crash = 1;
   output_1.nsp = 0;
-  return auction_();
+  return auction_(state);
 }
 
-int relax4_run()
+int relax4_run(relax4_state *state)
 {
   /* CALL RELAX4 TO SOLVE THE PROBLEM */
-  int result = relax4_();
+  int result = relax4_(state);
 
   /*     DISPLAY RELAX4 STATISTICS */
   /*
@@ -3915,7 +3914,7 @@ int relax4_run()
   return result;
 }
 
-int relax4_check_output()
+int relax4_check_output(relax4_state *state)
 {
   RELAX4_INT i;
 
@@ -3937,8 +3936,10 @@ int relax4_check_output()
   return RELAX4_OK;
 }
 
-void relax4_free()
+void relax4_free(relax4_state *state)
 {
+  if (state == NULL)
+    return;
   if(arrayrc_1.rc  ) free(arrayrc_1.rc  );
   if(blk1_1.i1     ) free(blk1_1.i1     );
   if(blk2_1.i2     ) free(blk2_1.i2     );
@@ -3957,5 +3958,6 @@ void relax4_free()
   if(blk15_1.i15   ) free(blk15_1.i15   );
   if(blk16_1.i16   ) free(blk16_1.i16   );
   if(blk17_1.i17   ) free(blk17_1.i17   );
+  free(state);
 }
 
@@ -56,20 +56,27 @@
 #define RELAX4_UNCAPACITATED (RELAX4_DEFAULT_LARGE/10)
 
 /**
- * Set global state and allocate memory for internal arrays.
+ * Solver state for one problem: pointers to the input and output arrays, and
+ * the internal working arrays. It is created by relax4_init and must be passed
+ * to the other relax4_* functions. Problems with different states can be
+ * solved at the same time (e.g. in different threads).
+ */
+typedef struct relax4_state relax4_state;
+
+/**
+ * Create solver state and allocate memory for internal arrays.
  *
  * The input arrays are not copied. You can solve several instances of the same
  * size (same number of nodes and arcs) by modifying the input arrays and then
  * restarting the call sequence from relax4_check_inputs (or relax4_init_phase1,
  * if you trust your inputs).
  *
- * There can be only one relax4 problem active at a time, because it currently
- * uses global state.
- *
  * The caller is responsible for allocating (and later freeing) the arrays
  * passed to this function. The relax4_free method should be called to free the
- * internal arrays. If this call fails, you do not have to call relax4_free to
- * clean up the internal arrays.
+ * state and the internal arrays. If this call fails, you do not have to call
+ * relax4_free.
+ *
+ * @param[out] state set to the new state, or to NULL if this call fails
  *
  * @param[in] num_nodes number of nodes in the graph; strictly positive
  *
@@ -104,7 +111,8 @@
  * @return RELAX4_OK if allocations succeeded, or RELAX4_FAIL_OUT_OF_MEMORY if
  * any failed.
  */
-int relax4_init(RELAX4_INT num_nodes, RELAX4_INT num_arcs,
+int relax4_init(relax4_state **state,
+    RELAX4_INT num_nodes, RELAX4_INT num_arcs,
     RELAX4_INT start_nodes[],
     RELAX4_INT end_nodes[],
     RELAX4_INT costs[],
@@ -125,7 +133,7 @@ int relax4_init(RELAX4_INT num_nodes, RELAX4_INT num_arcs,
  * RELAX4_FAIL_BAD_NODE (in start_nodes or end_nodes), RELAX4_FAIL_BAD_COST or
  * RELAX4_FAIL_BAD_CAPACITY otherwise.
  */
-int relax4_check_inputs(int max_cost);
+int relax4_check_inputs(relax4_state *state, int max_cost);
 
 /**
  * Reduce arc capacities by as much as possible without changing the problem.
@@ -133,7 +141,7 @@ int relax4_check_inputs(int max_cost);
  * @return RELAX4_OK if successful; RELAX4_INFEASIBLE if problem was found
  * to be infeasible during arc capacity reduction.
  */
-int relax4_init_phase_1();
+int relax4_init_phase_1(relax4_state *state);
 
 /**
  * Initialize the arc flows to satisfy complementary slackness with the node
@@ -145,7 +153,7 @@ int relax4_init_phase_1();
  * @return RELAX4_OK if successful; RELAX4_INFEASIBLE if problem was found to be
  * infeasible.
  */
-int relax4_init_phase_2();
+int relax4_init_phase_2(relax4_state *state);
 
 /**
  * Uses a version of the auction algorithm for min cost network flow to compute
@@ -161,7 +169,27 @@ int relax4_init_phase_2();
  * @return RELAX4_OK if successful; RELAX4_INFEASIBLE if problem was found to be
  * infeasible.
  */
-int relax4_auction();
+int relax4_auction(relax4_state *state);
+
+/**
+ * Initialize from the solution to the previous problem, instead of calling
+ * relax4_init_phase_1 and relax4_init_phase_2 (or relax4_auction).
+ *
+ * This keeps the node prices from the last call to relax4_run and starts from
+ * the flows currently in the <tt>flows</tt> array (adjusted to satisfy
+ * complementary slackness), so it is typically much faster than a cold start
+ * when only a few demands have changed. The solution is optimal, but when
+ * there are several optimal solutions, it may not be the same one that a cold
+ * start would find.
+ *
+ * You must have called relax4_run on this state first, and you must not have
+ * changed the arcs or their costs since. Demands and capacities may change, but
+ * note that relax4_run overwrites both, so they must be reset before each call.
+ *
+ * @return RELAX4_OK if successful; RELAX4_INFEASIBLE if problem was found to be
+ * infeasible.
+ */
+int relax4_init_warm(relax4_state *state);
 
 /**
  * The main solve routine.
@@ -171,12 +199,13 @@ int relax4_auction();
  * is returned. See also the notes in relax4_init regarding negative cost
  * cycles.
  *
- * You must call (exactly) one of relax4_init_phase_2 or relax4_auction first.
+ * You must call (exactly) one of relax4_init_phase_2, relax4_auction or
+ * relax4_init_warm first.
  *
  * @return RELAX4_OK if successful; RELAX4_INFEASIBLE if problem was found to be
  * infeasible.
  */
-int relax4_run();
+int relax4_run(relax4_state *state);
 
 /**
  * Check that there are no unsatisfied demands and that complementary slackness
@@ -190,14 +219,14 @@ int relax4_run();
  * RELAX4_OUTPUT_FAIL_NONZERO_DEMAND or
  * RELAX4_OUTPUT_FAIL_COMPLEMENTARY_SLACKNESS.
  */
-int relax4_check_output();
+int relax4_check_output(relax4_state *state);
 
 /**
- * Free internal working arrays.
+ * Free the state and its internal working arrays; state may be NULL.
  *
  * The caller is responsible for freeing the input and output arrays passed in
  * via relax4_init.
  */
-void relax4_free();
+void relax4_free(relax4_state *state);
 
 #endif /* guard */
@@ -24,7 +24,63 @@ void si_taxi_hello_world() {
 namespace si_taxi {
 
 // storage; declared in si_taxi.h
-boost::mt19937 rng;
+RNG rng;
+
+void check_station_index_range(size_t num_stations) {
+  CHECK_MSG(num_stations == 0 ||
+      num_stations - 1 <= (size_t)numeric_limits<StationIndex>::max(),
+      num_stations << " stations do not fit in StationIndex; rebuild with a"
+      " larger SI_TAXI_STATION_BITS");
+}
+
+void Xoshiro128StarStar::seed(result_type seed) {
+  boost::uint64_t x = seed;
+  for (size_t i = 0; i < 4; i += 2) {
+    // splitmix64
+    boost::uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z = z ^ (z >> 31);
+    _s[i] = (result_type)z;
+    _s[i + 1] = (result_type)(z >> 32);
+  }
+}
+
+void Xoshiro128StarStar::jump() {
+  static const result_type JUMP[] = {
+    0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b };
+  jump(JUMP);
+}
+
+void Xoshiro128StarStar::long_jump() {
+  static const result_type LONG_JUMP[] = {
+    0xb523952e, 0x0b6f099f, 0xccf5a0ef, 0x1c580662 };
+  jump(LONG_JUMP);
+}
+
+void Xoshiro128StarStar::jump(const result_type *poly) {
+  result_type s[4] = { 0, 0, 0, 0 };
+  for (size_t i = 0; i < 4; ++i) {
+    for (int b = 0; b < 32; ++b) {
+      if (poly[i] & (1U << b)) {
+        for (size_t j = 0; j < 4; ++j)
+          s[j] ^= _s[j];
+      }
+      (*this)();
+    }
+  }
+  std::copy(s, s + 4, _s);
+}
+
+void RNGStream::seed(RNG::result_type seed, size_t replication,
+    size_t rollout) {
+  _rng.seed(seed);
+  for (size_t i = 0; i < replication; ++i)
+    _rng.long_jump();
+  for (size_t j = 0; j < rollout; ++j)
+    _rng.jump();
+  _seeded = true;
+}
 
 //
 // Stack trace code based on http://www.mr-edd.co.uk/blog/stack_trace_x86
@@ -122,6 +178,43 @@ si_taxi::Error::Error(const char* message, int line, const char* file,
   _what += os.str();
 }
 
+std::vector<int> apportion(size_t total, const std::vector<double> &weights)
+{
+  std::vector<int> counts(weights.size(), 0);
+  if (total == 0)
+    return counts;
+
+  double weight_sum = 0;
+  for (size_t i = 0; i < weights.size(); ++i) {
+    CHECK(weights[i] >= 0);
+    weight_sum += weights[i];
+  }
+  CHECK(weight_sum > 0);
+
+  // Give each part the integer part of its quota, then hand out the rest in
+  // descending order by remainder (stable, so ties go to the lowest index).
+  std::vector<double> remainders(weights.size());
+  size_t assigned = 0;
+  for (size_t i = 0; i < weights.size(); ++i) {
+    double quota = total * weights[i] / weight_sum;
+    counts[i] = (int)floor(quota);
+    remainders[i] = -(quota - counts[i]);
+    assigned += counts[i];
+  }
+  CHECK(assigned <= total);
+
+  std::vector<size_t> pi(weights.size());
+  for (size_t i = 0; i < pi.size(); ++i) {
+    pi[i] = i;
+  }
+  stable_sort(pi.begin(), pi.end(), compare_perm(remainders));
+  for (size_t n = 0; assigned < total; n = (n + 1) % pi.size()) {
+    ++counts[pi[n]];
+    ++assigned;
+  }
+  return counts;
+}
+
 // helper for all_square_matrices_with_row_sums_lte
 struct F_get_matrix_data {
   std::vector<std::vector<int> > results;
@@ -4,6 +4,7 @@
 #ifndef SI_TAXI_H_
 #define SI_TAXI_H_
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -36,10 +37,171 @@ const size_t SIZE_T_MAX = std::numeric_limits<size_t>::max();
  */
 const double DOUBLE_MAX = std::numeric_limits<double>::max();
 
+/*
+ * Vehicle and passenger records (BWVehicle, BWPax, MDPPax, etc.) store station
+ * indexes and times in the types below. By default these are size_t and long,
+ * but the library can be built with smaller types, which shrinks the records
+ * by a factor of two or three; this matters for large fleets and for sampling
+ * and voting, which copies the vehicle state for each sample.
+ *
+ * SI_TAXI_STATION_BITS: 16, 32 or 0 (size_t)
+ * SI_TAXI_TIME_BITS: 32 or 0 (long); for BWTime and MDPTime
+ *
+ * The sims check at init that their stations fit in StationIndex, and the
+ * Poisson pax streams check that arrival times fit in BWTime.
+ */
+#ifndef SI_TAXI_STATION_BITS
+#define SI_TAXI_STATION_BITS 0
+#endif
+
+#ifndef SI_TAXI_TIME_BITS
+#define SI_TAXI_TIME_BITS 0
+#endif
+
+/**
+ * Index of a station in a vehicle or passenger record; see above. Methods
+ * still take and return station indexes as size_t.
+ */
+#if SI_TAXI_STATION_BITS == 16
+typedef unsigned short StationIndex;
+#elif SI_TAXI_STATION_BITS == 32
+typedef unsigned int StationIndex;
+#elif SI_TAXI_STATION_BITS == 0
+typedef size_t StationIndex;
+#else
+#error "SI_TAXI_STATION_BITS must be 16, 32 or 0"
+#endif
+
+#if SI_TAXI_TIME_BITS != 32 && SI_TAXI_TIME_BITS != 0
+#error "SI_TAXI_TIME_BITS must be 32 or 0"
+#endif
+
+/**
+ * Throw if a network with the given number of stations does not fit in
+ * StationIndex.
+ */
+void check_station_index_range(size_t num_stations);
+
+/**
+ * The xoshiro128** generator of Blackman and Vigna: 128 bits of state, 32-bit
+ * outputs and a period of 2^128 - 1. It is much cheaper to seed and copy than
+ * the Mersenne twister, and it can jump ahead, which splits its period into
+ * non-overlapping substreams; see RNGStream. It meets the requirements for
+ * the Boost.Random distributions and the helpers in random.h.
+ */
+struct Xoshiro128StarStar {
+  typedef boost::uint32_t result_type;
+  static const bool has_fixed_range = false;
+
+  explicit Xoshiro128StarStar(result_type seed = 5489) {
+    this->seed(seed);
+  }
+
+  /**
+   * Fill the state from the given seed with splitmix64, as recommended by
+   * the authors; different seeds give unrelated states.
+   */
+  void seed(result_type seed);
+
+  /**
+   * Advance the state by 2^64 draws; this gives 2^64 non-overlapping
+   * sequences of 2^64 draws each.
+   */
+  void jump();
+
+  /**
+   * Advance the state by 2^96 draws; this gives 2^32 starting points, from
+   * each of which jump() can be used to make 2^32 further subsequences.
+   */
+  void long_jump();
+
+  result_type min() const { return 0; }
+  result_type max() const { return 0xffffffffU; }
+
+  result_type operator()() {
+    const result_type result = rotl(_s[1] * 5, 7) * 9;
+    const result_type t = _s[1] << 9;
+    _s[2] ^= _s[0];
+    _s[3] ^= _s[1];
+    _s[1] ^= _s[2];
+    _s[0] ^= _s[3];
+    _s[2] ^= t;
+    _s[3] = rotl(_s[3], 11);
+    return result;
+  }
+
+  bool operator==(const Xoshiro128StarStar &other) const {
+    return std::equal(_s, _s + 4, other._s);
+  }
+  bool operator!=(const Xoshiro128StarStar &other) const {
+    return !(*this == other);
+  }
+
+private:
+  static result_type rotl(result_type x, int k) {
+    return (x << k) | (x >> (32 - k));
+  }
+
+  /// xor into the state the states at which the given polynomial's bits are
+  /// set; used by jump and long_jump
+  void jump(const result_type *poly);
+
+  result_type _s[4];
+};
+
+typedef Xoshiro128StarStar RNG;
+
 /**
  * We'll just keep one global rng for now. Storage in si_taxi.cpp.
  */
-extern boost::mt19937 rng;
+extern RNG rng;
+
+/**
+ * A random number generator owned by a simulation or passenger stream.
+ *
+ * Until seed is called, it draws from the global si_taxi::rng, so code that
+ * seeds the global generator works as before. Once seeded, it has its own
+ * state: the substream for a given (seed, replication, rollout) is the same
+ * no matter what else runs in the process, or in which thread, so two
+ * objects seeded with the same seed and different replication or rollout
+ * numbers get independent and reproducible sequences.
+ */
+struct RNGStream {
+  RNGStream() : _seeded(false) { }
+
+  /**
+   * Use our own generator, starting from substream (replication, rollout) of
+   * the given seed. This takes replication long jumps and rollout jumps (see
+   * Xoshiro128StarStar), so it is O(replication + rollout); seed once per
+   * replication or rollout, not per draw.
+   */
+  void seed(RNG::result_type seed, size_t replication = 0,
+      size_t rollout = 0);
+
+  /**
+   * Use our own generator, starting from the given state; this is O(1), so
+   * it suits callers that make many substreams with their own jumps.
+   */
+  void seed(const RNG &rng) {
+    _rng = rng;
+    _seeded = true;
+  }
+
+  /**
+   * Go back to drawing from si_taxi::rng.
+   */
+  void unseed() { _seeded = false; }
+
+  /// true iff seed has been called (and unseed has not been called since)
+  bool seeded() const { return _seeded; }
+
+  /// the generator to draw from
+  RNG &get() { return _seeded ? _rng : si_taxi::rng; }
+
+private:
+  bool _seeded;
+  RNG _rng;
+};
 
 /**
  * Base class for exceptions. This is a light-weight exception. Use the
@@ -90,8 +252,6 @@ protected:
   std::string _function;
 };
 
-typedef boost::mt19937 RNG;
-
 /**
  * Cumulative average, where average is the average over the last count points
  * and x is the point just observed. Note that this method increments count.
@@ -102,6 +262,16 @@ T cumulative_moving_average(T x, T average, N &count) {
   return average + (x - average) / count;
 }
 
+/**
+ * Split total into integer parts in proportion to the given non-negative
+ * weights, using the largest remainder method; leftover units go to the
+ * largest remainders, with ties broken by lowest index. The weights must not
+ * all be zero (unless total is zero).
+ *
+ * @return one count per weight; the counts sum to total
+ */
+std::vector<int> apportion(size_t total, const std::vector<double> &weights);
+
 /**
  * List all matrices with non-negative integer entries, zeros on the diagonal,
  * and row sums less than or equal to the given sums. The matrices are returned
@@ -7,14 +7,22 @@
  * the ruby interface.
  */
 #include <si_taxi/stdafx.h>
+#include <ctime>
+#include <cstring>
 #include <si_taxi/si_taxi.h>
 #include <si_taxi/utility.h>
+#include <si_taxi/random.h>
 #include <si_taxi/bell_wong/bell_wong.h>
+#include <si_taxi/bell_wong/bell_wong_t.h>
 #include <si_taxi/bell_wong/dynamic_tp.h>
+#include <si_taxi/bell_wong/replications.h>
 #include <si_taxi/bell_wong/sampling_voting.h>
+#include <si_taxi/min_cost_flow.h>
 #include <si_taxi/mdp_sim/mdp_sim.h>
 #include <si_taxi/mdp_sim/tabular_sarsa_solver.h>
 
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
 using namespace std;
 using namespace si_taxi;
 
@@ -479,8 +487,469 @@ void test_7_run_tabular_sarsa() {
 #endif
 }
 
+/**
+ * A min cost flow problem in the format written by
+ * BWDynamicTransportationProblemHandler::dump_problem.
+ */
+struct MinCostFlowProblem {
+  int num_nodes;
+  std::vector<int> start_nodes;
+  std::vector<int> end_nodes;
+  std::vector<int> costs;
+  std::vector<int> capacities;
+  std::vector<int> demands;
+};
+
+void read_min_cost_flow_problems(istream &is,
+    std::vector<MinCostFlowProblem> &problems) {
+  int num_nodes, num_arcs;
+  while (is >> num_nodes >> num_arcs) {
+    problems.push_back(MinCostFlowProblem());
+    MinCostFlowProblem &p = problems.back();
+    p.num_nodes = num_nodes;
+    p.start_nodes.resize(num_arcs);
+    p.end_nodes.resize(num_arcs);
+    p.costs.resize(num_arcs);
+    p.capacities.resize(num_arcs);
+    p.demands.resize(num_nodes);
+    for (int a = 0; a < num_arcs; ++a) {
+      is >> p.start_nodes[a] >> p.end_nodes[a] >> p.costs[a] >> p.capacities[a];
+    }
+    for (int i = 0; i < num_nodes; ++i) {
+      int surplus;
+      is >> surplus;
+      p.demands[i] = -surplus;
+    }
+    CHECK(is);
+  }
+}
+
+// Replay DTP problems against each min cost flow solver. The problems are
+// read from the given file (see BWDynamicTransportationProblemHandler's
+// dump_problems_to), or else collected from a run on the grid network.
+void test_8_min_cost_flow_benchmark(const char *file_name) {
+  std::vector<MinCostFlowProblem> problems;
+  if (file_name) {
+    ifstream is(file_name);
+    CHECK(is);
+    read_min_cost_flow_problems(is, problems);
+  } else {
+    si_taxi::BWSim sim;
+    load_grid_24st_800m_del01s_trip_times(sim);
+    boost::numeric::ublas::matrix<double> scaled_od_demand;
+    load_grid_24st_800m_del01s_demand_1(scaled_od_demand);
+    sim.add_vehicles_in_turn(200);
+
+    BWNNHandler reactive(sim);
+    BWDynamicTransportationProblemHandler proactive(sim);
+    BWSimStatsMeanPaxWait stats(sim);
+    ostringstream os;
+    proactive.dump_problems_to = &os;
+    sim.reactive = &reactive;
+    sim.proactive = &proactive;
+    sim.stats = &stats;
+
+    BWPoissonPaxStream pax_stream(0, scaled_od_demand);
+    si_taxi::rng.seed(123);
+    sim.init();
+    sim.park_vehicles_in_turn();
+    for (size_t i = 0; i < sim.num_stations(); ++i) {
+      proactive.targets[i] = si_taxi::rng() % 10;
+    }
+    sim.handle_pax_stream(2000, &pax_stream);
+
+    istringstream is(os.str());
+    read_min_cost_flow_problems(is, problems);
+  }
+  CHECK(!problems.empty());
+  cout << problems.size() << " problems with " << problems[0].num_nodes <<
+      " nodes and " << problems[0].start_nodes.size() << " arcs" << endl;
+
+  const char *names[] = {"relax4", "relax4 (warm)", "network simplex",
+      "successive shortest path"};
+  const MinCostFlowSolverType types[] = {MIN_COST_FLOW_RELAX4,
+      MIN_COST_FLOW_RELAX4, MIN_COST_FLOW_NETWORK_SIMPLEX,
+      MIN_COST_FLOW_SUCCESSIVE_SHORTEST_PATH};
+  std::vector<double> objectives;
+  for (size_t s = 0; s < sizeof(types) / sizeof(types[0]); ++s) {
+    bool warm_start = s == 1;
+    MinCostFlowSolver *solver = new_min_cost_flow_solver(types[s]);
+    std::vector<int> start_nodes, end_nodes, costs, capacities, demands, flows;
+    double total_objective = 0;
+    clock_t total_clocks = 0;
+    for (size_t n = 0; n < problems.size(); ++n) {
+      const MinCostFlowProblem &p = problems[n];
+      bool same_arcs = n > 0 && p.start_nodes == start_nodes &&
+          p.end_nodes == end_nodes && p.costs == costs;
+      if (!same_arcs) {
+        start_nodes = p.start_nodes;
+        end_nodes = p.end_nodes;
+        costs = p.costs;
+        capacities.resize(costs.size());
+        demands.resize(p.num_nodes);
+        flows.resize(costs.size());
+        solver->init(p.num_nodes, (int)costs.size(), &start_nodes[0],
+            &end_nodes[0], &costs[0], &capacities[0], &demands[0], &flows[0]);
+      }
+      copy(p.capacities.begin(), p.capacities.end(), capacities.begin());
+      copy(p.demands.begin(), p.demands.end(), demands.begin());
+
+      clock_t start = clock();
+      CHECK(solver->solve(warm_start && same_arcs));
+      total_clocks += clock() - start;
+
+      for (size_t a = 0; a < costs.size(); ++a) {
+        total_objective += (double)flows[a] * costs[a];
+      }
+    }
+    delete solver;
+
+    cout << names[s] << ": " << 1e6 * total_clocks / CLOCKS_PER_SEC /
+        problems.size() << "us per solve" << endl;
+    objectives.push_back(total_objective);
+    CHECK(objectives.back() == objectives.front());
+  }
+}
+
+// Time sampling from random OD matrices (with zero diagonals) with binary
+// search on the cdf and with the alias method, one at a time and in batches.
+void test_9_empirical_sampler_benchmark() {
+  const size_t num_stations[] = {10, 30, 100, 300, 1000};
+  const size_t num_samples = 1000000;
+  const char *names[] = {"binary search", "alias"};
+  const EmpiricalSamplerMethod methods[] = {EMPIRICAL_SAMPLER_BINARY_SEARCH,
+      EMPIRICAL_SAMPLER_ALIAS};
+  si_taxi::rng.seed(123);
+  for (size_t t = 0; t < sizeof(num_stations) / sizeof(num_stations[0]); ++t) {
+    size_t n = num_stations[t];
+    boost::numeric::ublas::matrix<double> od(n, n);
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        od(i, j) = i == j ? 0 : genrand_c01o<double>(si_taxi::rng);
+      }
+    }
+
+    for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); ++m) {
+      clock_t start = clock();
+      ODMatrixWrapper od_wrapper(od, methods[m]);
+      clock_t setup_clocks = clock() - start;
+
+      size_t origin, destin, checksum = 0;
+      double interval;
+      start = clock();
+      for (size_t k = 0; k < num_samples; ++k) {
+        od_wrapper.sample(origin, destin, interval);
+        checksum += origin;
+      }
+      clock_t sample_clocks = clock() - start;
+      CHECK(checksum < num_samples * n);
+
+      // the same, in batches
+      const size_t batch_size = 256;
+      std::vector<size_t> origins(batch_size), destins(batch_size);
+      std::vector<double> intervals(batch_size);
+      size_t batch_checksum = 0;
+      start = clock();
+      for (size_t k = 0; k < num_samples; k += batch_size) {
+        od_wrapper.sample_batch(batch_size, &origins[0], &destins[0],
+            &intervals[0], si_taxi::rng);
+        for (size_t b = 0; b < batch_size; ++b) {
+          batch_checksum += origins[b];
+        }
+      }
+      clock_t batch_clocks = clock() - start;
+      CHECK(batch_checksum < (num_samples + batch_size) * n);
+
+      cout << n << " stations, " << names[m] << ": " <<
+          1e3 * setup_clocks / CLOCKS_PER_SEC << "ms setup, " <<
+          1e9 * sample_clocks / CLOCKS_PER_SEC / num_samples <<
+          "ns per sample, " <<
+          1e9 * batch_clocks / CLOCKS_PER_SEC / num_samples <<
+          "ns per sample in batches of " << batch_size << endl;
+    }
+  }
+}
+
+// The setup from test_4, for BWReplicationRunner.
+struct GridDynamicTPScenario : public BWScenario {
+  size_t num_veh;
+  boost::numeric::ublas::matrix<double> od;
+
+  GridDynamicTPScenario(size_t num_veh) : num_veh(num_veh) {
+    load_grid_24st_800m_del01s_demand_1(od);
+  }
+
+  virtual void build(BWReplication &rep) {
+    load_grid_24st_800m_del01s_trip_times(rep.sim);
+    rep.sim.add_vehicles_in_turn(num_veh);
+    rep.reactive = new BWNNHandler(rep.sim);
+    rep.proactive = new BWDynamicTransportationProblemHandler(rep.sim);
+    rep.pax_stream = new BWPoissonPaxStream(0, od);
+  }
+
+  virtual void start(BWReplication &rep) {
+    BWDynamicTransportationProblemHandler *proactive =
+        static_cast<BWDynamicTransportationProblemHandler *>(rep.proactive);
+    for (size_t i = 0; i < rep.sim.num_stations(); ++i) {
+      proactive->targets[i] = rep.sim.rng.get()() % 10;
+    }
+  }
+};
+
+// Run the test_4 replications with one thread and then with each of the given
+// comma-separated numbers of threads (e.g. "2,4,8,16,32"); the results should
+// be the same, and the run time should fall roughly in proportion to the
+// number of threads, up to the number of cores. The speedups are relative to
+// the one thread run. This has only been run on a single core machine, where
+// there is no speedup (1 thread: 30444ms; 2 threads: 31223ms; 4 threads:
+// 31221ms); the scaling on a multi-core machine has not been measured.
+void test_10_bell_wong_replications_grid(const char *threads) {
+  GridDynamicTPScenario scenario(200);
+  BWReplicationRunner runner(scenario);
+  runner.num_replications = 50;
+  runner.num_pax = 5000;
+  runner.seed = 123;
+
+  vector<size_t> num_threads(1, 1);
+  for (const char *p = threads; p && *p; ) {
+    num_threads.push_back((size_t)atoi(p));
+    CHECK(num_threads.back() > 0);
+    p = strchr(p, ',');
+    if (p)
+      ++p;
+  }
+
+  vector<double> mean_pax_wait;
+  long base_ms = 0;
+  for (size_t t = 0; t < num_threads.size(); ++t) {
+    runner.num_threads = num_threads[t];
+    boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::universal_time();
+    BWReplicationStats stats = runner.run();
+    boost::posix_time::time_duration elapsed =
+        boost::posix_time::microsec_clock::universal_time() - start;
+
+    double total = 0;
+    for (size_t r = 0; r < stats.mean_pax_wait.size(); ++r) {
+      total += stats.mean_pax_wait[r];
+    }
+    long ms = elapsed.total_milliseconds();
+    if (t == 0)
+      base_ms = ms;
+    cout << runner.num_threads << " threads: " << ms << "ms, speedup " <<
+        (double)base_ms / max(ms, 1L) << ", mean wait " <<
+        total / stats.mean_pax_wait.size() << endl;
+
+    if (t == 0)
+      mean_pax_wait = stats.mean_pax_wait;
+    else
+      CHECK(mean_pax_wait == stats.mean_pax_wait);
+  }
+}
+
+// Run the test_4 grid scenario, with NN and no proactive handler, with BWSim
+// and with BWSimT from the same seed; the results should be the same. The
+// proactive handler does nothing, so the time is mostly in the simulation
+// loop and the handler calls, which is where BWSimT saves; on one machine,
+// BWSimT took about 3% less time (1058-1127ms, against 1091-1165ms for
+// BWSim, over five runs).
+template <typename Sim>
+double run_bell_wong_grid_with(Sim &sim, BWSimStatsMeanPaxWait &stats,
+    size_t num_pax, size_t reps, unsigned int seed) {
+  boost::numeric::ublas::matrix<double> scaled_od_demand;
+  load_grid_24st_800m_del01s_demand_1(scaled_od_demand);
+  BWPoissonPaxStream pax_stream(0, scaled_od_demand);
+  sim.rng.seed(seed, 0, 0);
+  pax_stream.rng.seed(seed, 0, 1);
+
+  boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::universal_time();
+  double total = 0;
+  for (size_t rep = 0; rep < reps; ++rep) {
+    sim.init();
+    pax_stream.reset(0);
+    sim.park_vehicles_in_turn();
+    sim.handle_pax_stream(num_pax, &pax_stream);
+    total += stats.mean_pax_wait;
+  }
+  boost::posix_time::time_duration elapsed =
+      boost::posix_time::microsec_clock::universal_time() - start;
+  cout << elapsed.total_milliseconds() << "ms, mean wait " <<
+      total / reps << endl;
+  return total;
+}
+
+void test_11_bell_wong_static_dispatch_grid() {
+  size_t num_pax = 5000;
+  size_t reps = 200;
+  size_t num_veh = 200;
+  unsigned int seed = 123;
+
+  si_taxi::BWSim sim;
+  load_grid_24st_800m_del01s_trip_times(sim);
+  sim.add_vehicles_in_turn(num_veh);
+  BWNNHandler reactive(sim);
+  BWProactiveHandler proactive(sim);
+  BWSimStatsMeanPaxWait stats(sim);
+  sim.reactive = &reactive;
+  sim.proactive = &proactive;
+  sim.stats = &stats;
+  cout << "BWSim: ";
+  double total = run_bell_wong_grid_with(sim, stats, num_pax, reps, seed);
+
+  BWSimT<BWNNHandler, BWProactiveHandler, BWSimStatsMeanPaxWait> sim_t;
+  load_grid_24st_800m_del01s_trip_times(sim_t);
+  sim_t.add_vehicles_in_turn(num_veh);
+  BWNNHandler reactive_t(sim_t);
+  BWProactiveHandler proactive_t(sim_t);
+  BWSimStatsMeanPaxWait stats_t(sim_t);
+  sim_t.set_handlers(reactive_t, proactive_t, stats_t);
+  cout << "BWSimT: ";
+  double total_t = run_bell_wong_grid_with(sim_t, stats_t, num_pax, reps,
+      seed);
+
+  CHECK(total == total_t);
+}
+
+// Check the record sizes and range checks for the SI_TAXI_STATION_BITS and
+// SI_TAXI_TIME_BITS build flags; run this with the flags set, e.g.
+// -DSI_TAXI_STATION_BITS=16 -DSI_TAXI_TIME_BITS=32, as well as without.
+void test_12_compact_types() {
+  // The records should be no larger than their fields, padded for alignment,
+  // so that the smaller types do shrink them.
+  size_t align = max(sizeof(StationIndex), sizeof(BWTime));
+  size_t packed = 2 * sizeof(StationIndex) + sizeof(BWTime);
+  size_t padded = (packed + align - 1) / align * align;
+  CHECK(sizeof(BWVehicle) == padded);
+  CHECK(sizeof(BWPax) == padded);
+#if SI_TAXI_STATION_BITS == 16 && SI_TAXI_TIME_BITS == 32
+  CHECK(sizeof(BWVehicle) == 8);
+  CHECK(sizeof(BWPax) == 8);
+#endif
+  cout << "BWVehicle: " << sizeof(BWVehicle) << " bytes, BWPax: " <<
+      sizeof(BWPax) << " bytes" << endl;
+
+  // Station indexes 0 to max must fit; max + 1 must not.
+  check_station_index_range(0);
+  check_station_index_range(1000);
+#if SI_TAXI_STATION_BITS != 0
+  size_t max_index = numeric_limits<StationIndex>::max();
+  check_station_index_range(max_index + 1);
+  bool threw = false;
+  try {
+    check_station_index_range(max_index + 2);
+  } catch (const std::exception &) {
+    threw = true;
+  }
+  CHECK(threw);
+#endif
+
+  // Arrival times must fit in BWTime; with very low demand, the first one
+  // does not fit in 32 bits.
+#if SI_TAXI_TIME_BITS == 32
+  boost::numeric::ublas::matrix<double> od(2, 2);
+  od(0, 0) = od(1, 1) = 0;
+  od(0, 1) = od(1, 0) = 1e-12;
+  BWPoissonPaxStream pax_stream(0, od);
+  pax_stream.rng.seed(123);
+  bool time_threw = false;
+  try {
+    pax_stream.next_pax();
+  } catch (const std::exception &) {
+    time_threw = true;
+  }
+  CHECK(time_threw);
+#endif
+}
+
+// Run the given sim with and without BWSim::batch_pax and return the final
+// state and stats; the two runs should give the same results.
+template <typename Reactive>
+string run_batch_sim(const boost::numeric::ublas::matrix<int> &trip_time,
+    const boost::numeric::ublas::matrix<double> &od, size_t num_veh,
+    size_t num_pax, bool batch_pax) {
+  BWSim sim;
+  sim.trip_time = trip_time;
+  sim.batch_pax = batch_pax;
+  sim.coalesce_events = true;
+  Reactive reactive(sim);
+  BWProactiveHandler proactive(sim); // nop
+  BWSimStatsDetailed stats(sim);
+  sim.reactive = &reactive;
+  sim.proactive = &proactive;
+  sim.stats = &stats;
+  sim.add_vehicles_in_turn(num_veh);
+  sim.init();
+
+  BWPoissonPaxStream pax_stream(0, od);
+  sim.rng.seed(42, 0, 0);
+  pax_stream.rng.seed(42, 0, 1);
+  sim.handle_pax_stream(num_pax, &pax_stream);
+
+  ostringstream os;
+  os << sim.now << endl;
+  for (size_t k = 0; k < sim.vehs.size(); ++k) {
+    os << sim.vehs[k].origin << " " << sim.vehs[k].destin << " " <<
+        sim.vehs[k].arrive << endl;
+  }
+  for (size_t i = 0; i < stats.pax_wait.size(); ++i) {
+    os << stats.pax_wait[i].frequency << endl;
+  }
+  os << stats.empty_trips << endl;
+  return os.str();
+}
+
+template <typename Reactive>
+void check_batch_sim(const char *name,
+    const boost::numeric::ublas::matrix<int> &trip_time,
+    const boost::numeric::ublas::matrix<double> &od, size_t num_veh,
+    size_t num_pax) {
+  // Count the requests that arrive in the same time step as the one before,
+  // to make sure that there are batches.
+  BWPoissonPaxStream pax_stream(0, od);
+  pax_stream.rng.seed(42, 0, 1);
+  size_t num_batched = 0;
+  BWTime last_arrive = -1;
+  for (size_t p = 0; p < num_pax; ++p) {
+    BWPax pax = pax_stream.next_pax();
+    if (pax.arrive == last_arrive)
+      ++num_batched;
+    last_arrive = pax.arrive;
+  }
+  cout << name << ": " << num_batched << " of " << num_pax <<
+      " requests arrive with the one before" << endl;
+  CHECK(num_batched > 0);
+
+  CHECK(run_batch_sim<Reactive>(trip_time, od, num_veh, num_pax, true) ==
+      run_batch_sim<Reactive>(trip_time, od, num_veh, num_pax, false));
+}
+
+// Check that handling requests that arrive in the same time step in batches
+// (BWSim::batch_pax) gives the same results as handling them one at a time;
+// BWNNHandler has its own batch method, and BWETNNHandler uses the default.
+// This is the same as the "batch sim" test in bell_wong_test.rb, plus a
+// busier grid.
+void test_13_bell_wong_batch_pax() {
+  boost::numeric::ublas::matrix<int> ring(3, 3);
+  int ring_times[] = {0, 10, 30, 50, 0, 20, 30, 40, 0};
+  std::copy(ring_times, ring_times + 9, ring.data().begin());
+  boost::numeric::ublas::matrix<double> ring_od(3, 3);
+  double ring_rates[] = {0, 0.3, 0.2, 0.1, 0, 0.3, 0.2, 0.1, 0};
+  std::copy(ring_rates, ring_rates + 9, ring_od.data().begin());
+  check_batch_sim<BWNNHandler>("ring, NN", ring, ring_od, 20, 200);
+  check_batch_sim<BWETNNHandler>("ring, ETNN", ring, ring_od, 20, 200);
+
+  BWSim grid;
+  load_grid_24st_800m_del01s_trip_times(grid);
+  boost::numeric::ublas::matrix<double> grid_od;
+  load_grid_24st_800m_del01s_demand_1(grid_od);
+  grid_od *= 20;
+  check_batch_sim<BWNNHandler>("grid, NN", grid.trip_time, grid_od, 200,
+      20000);
+}
+
 int main(int argc, char **argv) {
-  if (argc == 2) {
+  if (argc == 2 || argc == 3) {
     int test = atoi(argv[1]);
     switch(test) {
     case 1: test_1_bell_wong_dynamic_tp_star();
@@ -497,6 +966,18 @@ int main(int argc, char **argv) {
       break;
     case 7: test_7_run_tabular_sarsa();
       break;
+    case 8: test_8_min_cost_flow_benchmark(argc == 3 ? argv[2] : NULL);
+      break;
+    case 9: test_9_empirical_sampler_benchmark();
+      break;
+    case 10: test_10_bell_wong_replications_grid(argc == 3 ? argv[2] : NULL);
+      break;
+    case 11: test_11_bell_wong_static_dispatch_grid();
+      break;
+    case 12: test_12_compact_types();
+      break;
+    case 13: test_13_bell_wong_batch_pax();
+      break;
     default:
       cout << "unknown test: " << argv[1] << endl;
     }
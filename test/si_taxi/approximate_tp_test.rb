@@ -0,0 +1,119 @@
+require 'si_taxi/test_helper'
+
+class ApproximateTransportationProblemTest < Test::Unit::TestCase
+  include BellWongTestHelper
+
+  context "two station ring (10, 20)" do
+    setup do
+      setup_sim TRIP_TIMES_2ST_RING_10_20
+      @rea = BWNNHandler.new(@sim)
+      @pro = BWApproximateTransportationProblemHandler.new(@sim)
+      @sim.reactive = @rea
+      @sim.proactive = @pro
+      @sim.init
+    end
+
+    should "have defaults set" do
+      assert_equal [0, 0], @pro.targets.to_a
+      assert_equal SiTaxi::BW_APPROXIMATE_TP_GREEDY, @pro.matching_method
+      assert_equal 0, @pro.gap_sample_interval
+    end
+
+    should "handle tidal flow" do
+      @pro.targets[0] = 2
+      @pro.targets[1] = 0
+
+      put_veh_at 0, 0
+      pax         0,  1,   0
+      assert_veh  0,  1,  10
+      pax         0,  1,   5
+      assert_veh  0,  1,  15
+      pax         0,  1,  20
+      assert_veh  0,  1,  40 # depart at 30s, because it went to 0 proactively
+      pax         0,  1,  25
+      assert_veh  0,  1,  45 # depart at 35s, because it went to 0 proactively
+
+      assert_wait_hists({0 => 2, 10 => 2}, {})
+    end
+  end
+
+  context "on three station ring (10s, 20s, 30s)" do
+    setup do
+      setup_sim TRIP_TIMES_3ST_RING_10_20_30
+      @rea = BWNNHandler.new(@sim)
+      @pro = BWApproximateTransportationProblemHandler.new(@sim)
+      @sim.reactive = @rea
+      @sim.proactive = @pro
+      @sim.init
+    end
+
+    should "move proactively" do
+      @pro.gap_sample_interval = 1
+      put_veh_at 0, 0, 0, 0
+      @pro.targets[0] = 2
+      @pro.targets[1] = 0
+      @pro.targets[2] = 2
+
+      @sim.strobe = 1
+      @sim.run_to 1
+
+      assert_veh  0,  2,  30, 0
+      assert_veh  0,  2,  30, 1
+      assert_veh  0,  0,   0, 2
+      assert_veh  0,  0,   0, 3
+
+      assert_equal 1, @pro.num_problems
+      assert_equal 1, @pro.num_gap_samples
+      assert_equal 60, @pro.sampled_approximate_cost
+      assert_equal 60, @pro.sampled_exact_cost
+      assert_equal 0, @pro.gap
+    end
+  end
+
+  context "on four stations where the closest match is a poor one" do
+    setup do
+      setup_sim [[ 0,   10, 10,   20],
+                 [10,    0, 20, 1000],
+                 [10,   20,  0,   10],
+                 [20, 1000, 10,    0]]
+      @rea = BWNNHandler.new(@sim)
+      @sim.reactive = @rea
+      put_veh_at 0, 1
+    end
+
+    should "report the gap for greedy matching" do
+      @pro = BWApproximateTransportationProblemHandler.new(@sim)
+      @pro.gap_sample_interval = 1
+      @pro.targets[2] = 1
+      @pro.targets[3] = 1
+      @sim.proactive = @pro
+      @sim.init
+
+      @sim.strobe = 1
+      @sim.run_to 1
+
+      assert_veh  0,  2,   10, 0
+      assert_veh  1,  3, 1000, 1
+      assert_equal 1010, @pro.sampled_approximate_cost
+      assert_equal 40, @pro.sampled_exact_cost
+      assert_in_delta 1010/40.0 - 1, @pro.gap, $delta
+    end
+
+    should "find the exact matching with regret" do
+      @pro = BWApproximateTransportationProblemHandler.new(@sim,
+        SiTaxi::BW_APPROXIMATE_TP_REGRET)
+      @pro.gap_sample_interval = 1
+      @pro.targets[2] = 1
+      @pro.targets[3] = 1
+      @sim.proactive = @pro
+      @sim.init
+
+      @sim.strobe = 1
+      @sim.run_to 1
+
+      assert_veh  0,  3,  20, 0
+      assert_veh  1,  2,  20, 1
+      assert_equal 0, @pro.gap
+    end
+  end
+end
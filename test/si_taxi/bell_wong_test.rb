@@ -404,6 +404,185 @@ class BellWongTest < Test::Unit::TestCase
     end
   end
 
+  context "event driven sim" do
+    #
+    # Proactive handler that records when it is called (and does nothing).
+    #
+    class RecordingProactiveHandler < BWProactiveHandler
+      attr_reader :calls
+      def initialize sim
+        super(sim)
+        @calls = []
+      end
+
+      def handle_idle veh
+        @calls << [:idle, sim.now, veh.origin, veh.destin]
+      end
+
+      def handle_strobe
+        @calls << [:strobe, sim.now]
+      end
+    end
+
+    #
+    # Run sim with a random stream; return the handler calls and stats.
+    #
+    def run_sim event_driven
+      setup_sim TRIP_TIMES_3ST_RING_10_20_30
+      @sim.event_driven = event_driven
+      @sim.strobe = 7
+      @sim.reactive = BWNNHandler.new(@sim)
+      @sim.proactive = RecordingProactiveHandler.new(@sim)
+      @sim.init
+      put_veh_at 0, 1, 2, 2
+
+      SiTaxi.seed_rng 42
+      stream = BWPoissonPaxStream.new(0,
+        [[   0, 0.01, 0.02],
+         [0.03,    0, 0.01],
+         [0.01, 0.02,    0]])
+      @sim.handle_pax_stream 50, stream
+      @sim.run_to @sim.now + 100
+
+      [@sim.now, @sim.proactive.calls,
+        @sim.vehs.to_a.map {|v| [v.origin, v.destin, v.arrive]},
+        @sim_stats.pax_wait.map(&:to_a), @sim_stats.queue_len.map(&:to_a),
+        @sim_stats.idle_vehs.map(&:to_a), @sim_stats.idle_vehs_total.to_a]
+    end
+
+    should "default to stepping through every time step" do
+      assert !BWSim.new.event_driven
+    end
+
+    should "match a sim that steps through every time step" do
+      assert_equal run_sim(false), run_sim(true)
+    end
+  end
+
+  context "batch sim" do
+    #
+    # Run sim with a busy random stream, so that many passengers arrive in the
+    # same time step; return the final state and stats.
+    #
+    def run_sim reactive_class, batch_pax
+      setup_sim TRIP_TIMES_3ST_RING_10_20_30
+      @sim.batch_pax = batch_pax
+      @sim.coalesce_events = true
+      @sim.reactive = reactive_class.new(@sim)
+      @sim.proactive = BWProactiveHandler.new(@sim) # nop
+      @sim.init
+      put_veh_at(*(0...20).map {|k| k % 3})
+
+      SiTaxi.seed_rng 42
+      stream = BWPoissonPaxStream.new(0,
+        [[  0, 0.3, 0.2],
+         [0.1,   0, 0.3],
+         [0.2, 0.1,   0]])
+      @sim.handle_pax_stream 200, stream
+
+      [@sim.now, @sim.vehs.to_a.map {|v| [v.origin, v.destin, v.arrive]},
+        @sim_stats.pax_wait.map(&:to_a), @sim_stats.empty_trips]
+    end
+
+    should "default to handling passengers one at a time" do
+      assert !BWSim.new.batch_pax
+    end
+
+    [BWNNHandler, BWETNNHandler].each do |reactive_class|
+      should "match a sim without batches with #{reactive_class}" do
+        assert_equal run_sim(reactive_class, false),
+          run_sim(reactive_class, true)
+      end
+    end
+  end
+
+  context "indexed sim" do
+    setup do
+      setup_sim TRIP_TIMES_3ST_RING_10_20_30
+      @sim.indexed = true
+      @sim.reactive = BWNNHandler.new(@sim)
+      @sim.proactive = BWProactiveHandler.new(@sim) # nop
+      @sim.init
+      put_veh_at 0, 1, 2, 2
+    end
+
+    #
+    # Vehicle counting queries, with and without the index.
+    #
+    def queries indexed
+      @sim.indexed = indexed
+      idle_vehs = IntVector.new([0]*3)
+      @sim.count_idle_vehs(idle_vehs)
+      (0...3).map {|i|
+        [@sim.num_vehicles_inbound(i),
+          @sim.num_vehicles_immediately_inbound(i),
+          @sim.num_vehicles_idle_by(i, @sim.now),
+          @sim.num_vehicles_idle_by(i, @sim.now + 15),
+          @sim.idle_veh_at(i)]
+      } << idle_vehs.to_a
+    ensure
+      @sim.indexed = true
+    end
+
+    should "default to not indexing" do
+      assert !BWSim.new.indexed
+    end
+
+    should "match the unindexed queries" do
+      SiTaxi.seed_rng 42
+      stream = BWPoissonPaxStream.new(0,
+        [[   0, 0.01, 0.02],
+         [0.03,    0, 0.01],
+         [0.01, 0.02,    0]])
+      50.times do
+        @sim.handle_pax stream.next_pax
+        assert_equal queries(false), queries(true)
+      end
+    end
+
+    # The NN handlers switch between two methods depending on the number of
+    # vehicles per station, so try a small and a large fleet.
+    [BWNNHandler, BWETNNHandler, BWSNNHandler, BWH1Handler].each do |reactive_class|
+      [7, 60].each do |num_veh|
+        should "make the same assignments with #{reactive_class} and #{num_veh} vehicles" do
+          od = [[   0, 0.05, 0.10],
+                [0.15,    0, 0.05],
+                [0.05, 0.10,    0]]
+          results = [false, true].map {|indexed|
+            setup_sim TRIP_TIMES_3ST_RING_10_20_30
+            @sim.indexed = indexed
+            if reactive_class == BWH1Handler
+              @sim.reactive = BWH1Handler.new(@sim, od, 0.5)
+            else
+              @sim.reactive = reactive_class.new(@sim)
+            end
+            @sim.proactive = BWProactiveHandler.new(@sim) # nop
+            @sim.init
+            put_veh_at(*(0...num_veh).map {|k| k % 3})
+
+            SiTaxi.seed_rng 42
+            stream = BWPoissonPaxStream.new(0, od)
+            (0...100).map {
+              @sim.handle_pax stream.next_pax
+              @sim.vehs.to_a.map {|v| [v.origin, v.destin, v.arrive]}
+            }
+          }
+          assert_equal results[0], results[1]
+        end
+      end
+    end
+
+    should "see vehicles that are changed directly" do
+      assert_equal 2, @sim.num_vehicles_inbound(2)
+      @sim.vehs[3] = BWVehicle.new(2, 0, 10)
+      @sim.veh_changed(3)
+      assert_equal 1, @sim.num_vehicles_inbound(2)
+      assert_equal 2, @sim.num_vehicles_inbound(0)
+      assert_equal 1, @sim.num_vehicles_idle_by(0, 0)
+      assert_equal 2, @sim.num_vehicles_idle_by(0, 10)
+    end
+  end
+
   context "for vehicle parking" do
     setup do
       setup_sim TRIP_TIMES_3ST_RING_10_20_30
@@ -437,6 +616,23 @@ class BellWongTest < Test::Unit::TestCase
       assert_veh  2,  2,  0
       assert_equal 2, @sim.vehs.to_a.select{|v| v.destin == 0}.size
     end
+
+    should "add vehicles from counts and in proportion to weights" do
+      @sim.add_vehicles_at [2, 0, 1]
+      assert_equal [[0,0,0], [0,0,0], [2,2,0]],
+        @sim.vehs.to_a.map {|v| [v.origin, v.destin, v.arrive]}
+
+      @sim.vehs.clear
+      @sim.add_vehicles_in_proportion 10, [1, 2, 1]
+      assert_equal [3, 5, 2], (0...3).map {|i| @sim.num_vehicles_inbound(i)}
+    end
+
+    should "add a large fleet in turn" do
+      @sim.add_vehicles_in_turn 200000, 1
+      assert_equal 200000, @sim.vehs.size
+      assert_equal [66666, 66667, 66667],
+        (0...3).map {|i| @sim.num_vehicles_inbound(i)}
+    end
   end
 
   context "BWNN vs ETNN on three station ring" do
@@ -669,5 +865,63 @@ class BellWongTest < Test::Unit::TestCase
       end
     end
   end
-end
 
+  context "BWH2 with several vehicles" do
+    setup do
+      setup_sim TRIP_TIMES_3ST_RING_10_20_30
+      @od = [[   0, 0.05, 0.10],
+             [0.15,    0, 0.05],
+             [0.05, 0.10,    0]]
+      @sim.reactive = BWH2Handler.new(@sim, @od, 0.5, 3)
+      @sim.proactive = BWProactiveHandler.new(@sim) # nop
+      @sim.init
+      put_veh_at 0, 0, 1, 1, 2, 2, 2
+    end
+
+    should "choose the vehicle with the lowest value" do
+      SiTaxi.seed_rng 42
+      stream = BWPoissonPaxStream.new(0, @od)
+      50.times do |r|
+        pax = stream.next_pax
+        pax.arrive = @sim.now if r % 3 > 0 # some requests in the same second
+        @sim.run_to pax.arrive
+
+        values = (0...@sim.vehs.size).map {|k| @sim.reactive.value(pax, k)}
+        assert_equal values.index(values.min), @sim.reactive.handle_pax(pax)
+        @sim.handle_pax pax
+      end
+    end
+  end
+
+  should "generate the same poisson requests in batches" do
+    od = [[0, 0.1, 0.2], [0.3, 0, 0.1], [0.2, 0.1, 0]]
+    paxs = [1, 7, 64].map do |batch_size|
+      SiTaxi.seed_rng 42
+      stream = BWPoissonPaxStream.new(0, od)
+      stream.batch_size = batch_size
+      (0...100).map {|r|
+        pax = stream.next_pax
+        [pax.origin, pax.destin, pax.arrive]}
+    end
+    assert_equal paxs[0], paxs[1]
+    assert_equal paxs[0], paxs[2]
+  end
+
+  should "generate reproducible poisson requests from seeded substreams" do
+    od = [[0, 0.1, 0.2], [0.3, 0, 0.1], [0.2, 0.1, 0]]
+    paxs = [[0, 0], [1, 0], [0, 1], [0, 0]].map do |replication, rollout|
+      SiTaxi.seed_rng rand(1000) # shouldn't matter once seeded
+      stream = BWPoissonPaxStream.new(0, od)
+      assert !stream.rng.seeded
+      stream.rng.seed(42, replication, rollout)
+      assert stream.rng.seeded
+      (0...100).map {|r|
+        pax = stream.next_pax
+        [pax.origin, pax.destin, pax.arrive]}
+    end
+    assert_equal paxs[0], paxs[3]
+    assert_not_equal paxs[0], paxs[1]
+    assert_not_equal paxs[0], paxs[2]
+    assert_not_equal paxs[1], paxs[2]
+  end
+end
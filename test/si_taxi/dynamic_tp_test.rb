@@ -74,6 +74,151 @@ class DynamicTransportationProblemTest < Test::Unit::TestCase
       assert_veh  0,  0,   0, 2
       assert_veh  0,  0,   0, 3
     end
+
+    should "not solve again when demands are unchanged" do
+      put_veh_at 0, 0, 1, 2
+      @pro.targets[0] = 1
+      @pro.targets[1] = 1
+      @pro.targets[2] = 1
+
+      @sim.strobe = 1
+      @sim.run_to 5
+
+      assert_equal 1, @pro.num_solves
+      assert @pro.num_solves_skipped > 0
+      assert_veh  0,  0,   0, 0
+      assert_veh  0,  0,   0, 1
+      assert_veh  1,  1,   0, 2
+      assert_veh  2,  2,   0, 3
+    end
+
+    should "reuse cached solutions" do
+      @pro.cache_size = 10
+      put_veh_at 0, 1, 2
+      @pro.targets[0] = 1
+      @pro.targets[1] = 1
+      @pro.targets[2] = 1
+
+      @sim.strobe = 1
+      @sim.run_to 2
+      @pro.targets[0] = 2
+      @sim.run_to 4
+      @pro.targets[0] = 1 # back to the first problem
+      @sim.run_to 6
+
+      assert_equal 2, @pro.num_solves
+      assert_equal 2, @pro.num_cache_misses
+      assert_equal 1, @pro.num_cache_hits
+      assert_veh  0,  0,   0, 0
+      assert_veh  1,  1,   0, 1
+      assert_veh  2,  2,   0, 2
+    end
+
+    should "move proactively with warm start" do
+      @pro.warm_start = true
+      put_veh_at 0, 0, 0, 0
+      @sim.strobe = 1
+      @sim.run_to 1
+      assert_equal 4, @sim.num_vehicles_inbound(0)
+
+      @pro.targets[0] = 2
+      @pro.targets[2] = 2
+      @sim.run_to 2
+      assert_equal 2, @sim.num_vehicles_inbound(0)
+      assert_equal 0, @sim.num_vehicles_inbound(1)
+      assert_equal 2, @sim.num_vehicles_inbound(2)
+
+      @pro.targets[0] = 3
+      @pro.targets[2] = 0
+      @sim.run_to 40
+      assert_equal 3, @sim.num_vehicles_inbound(0)
+      assert_equal 0, @sim.num_vehicles_inbound(1)
+      assert_equal 1, @sim.num_vehicles_inbound(2)
+    end
+
+    should "redistribute once per time step when coalescing events" do
+      @sim.coalesce_events = true
+      put_veh_at 0, 0, 0, 0
+      @pro.targets[0] = 1
+      @pro.targets[2] = 2
+
+      pax         0,  1,   0
+      pax         0,  1,   0
+      assert_equal 0, @pro.num_solves + @pro.num_solves_skipped
+
+      # The two idle events for the remaining vehicles and the two passengers
+      # are handled together at the end of time step 0.
+      @sim.run_to 1
+      assert_equal 1, @pro.num_solves + @pro.num_solves_skipped
+      assert_veh  0,  1,  10, 0
+      assert_veh  0,  1,  10, 1
+      assert_veh  0,  2,  30, 2
+      assert_veh  0,  0,   0, 3
+    end
+
+    should "move directly along paths in a sparse network" do
+      # Only the ring arcs 0->1->2->0 are left with one neighbour.
+      @pro = BWDynamicTransportationProblemHandler.new(@sim, 1)
+      @sim.proactive = @pro
+      assert @pro.sparse
+      assert_equal 3 + 2*3, @pro.num_arcs
+
+      put_veh_at 0, 0, 0, 0
+      @pro.targets[0] = 2
+      @pro.targets[1] = 0
+      @pro.targets[2] = 2
+
+      @sim.strobe = 1
+      @sim.run_to 1
+
+      assert_veh  0,  2,  30, 0
+      assert_veh  0,  2,  30, 1
+      assert_veh  0,  0,   0, 2
+      assert_veh  0,  0,   0, 3
+      assert_equal 0, @pro.num_fallbacks
+    end
+
+    should "move proactively with each min cost flow solver" do
+      [SiTaxi::MIN_COST_FLOW_RELAX4,
+       SiTaxi::MIN_COST_FLOW_NETWORK_SIMPLEX,
+       SiTaxi::MIN_COST_FLOW_SUCCESSIVE_SHORTEST_PATH].each do |solver_type|
+        @sim.init
+        @pro = BWDynamicTransportationProblemHandler.new(@sim, 0, solver_type)
+        @sim.proactive = @pro
+        assert_equal solver_type, @pro.solver_type
+
+        put_veh_at 0, 0, 0, 0
+        @pro.targets[0] = 2
+        @pro.targets[1] = 0
+        @pro.targets[2] = 2
+
+        @sim.strobe = 1
+        @sim.run_to 1
+
+        assert_veh  0,  2,  30, 0
+        assert_veh  0,  2,  30, 1
+        assert_veh  0,  0,   0, 2
+        assert_veh  0,  0,   0, 3
+      end
+    end
+
+    should "not share solver state with other instances" do
+      other = BWDynamicTransportationProblemHandler.new(@sim)
+      other.targets[1] = 4
+
+      put_veh_at 0, 0, 0, 0
+      @pro.targets[0] = 2
+      @pro.targets[1] = 0
+      @pro.targets[2] = 2
+
+      @sim.strobe = 1
+      @sim.run_to 1
+
+      assert_veh  0,  2,  30, 0
+      assert_veh  0,  2,  30, 1
+      assert_veh  0,  0,   0, 2
+      assert_veh  0,  0,   0, 3
+    end
   end
 
   should "run on a three station ring (10s, 20s, 30s)" do
@@ -30,6 +30,15 @@ class MDPSimTest < Test::Unit::TestCase
       assert_equal [[0, 0], [0, 0]], @m.stats.empty_trips
     end
 
+    should "add vehicles in turn, from counts and in proportion" do
+      @m.add_vehicles_in_turn 4, 1
+      assert_equal [[-1]*3,[-1]*2], @m.inbound.to_a
+      @m.add_vehicles_at [1, 0]
+      assert_equal 6, @m.num_vehicles
+      @m.add_vehicles_in_proportion 4, [3, 1]
+      assert_equal [[-1]*7,[-1]*3], @m.inbound.to_a
+    end
+
     should "check that an empty is available at 0" do
       @m.tick [[0,1],[0,0]], []
       assert_equal 1, @m.now
@@ -459,6 +468,17 @@ class MDPSimTest < Test::Unit::TestCase
         prev = @stream.now
       end
     end
+
+    should "generate the same requests in batches" do
+      paxs = [1, 16].map do |batch_size|
+        SiTaxi.seed_rng 42
+        @stream.reset(0)
+        @stream.batch_size = batch_size
+        (0...20).map {
+          @stream.next_pax.map {|pax| [pax.origin, pax.destin, pax.arrive]}}
+      end
+      assert_equal paxs[0], paxs[1]
+    end
   end
 
   context "MDPPoissonPaxStream with low demand" do
@@ -32,6 +32,72 @@ class SamplingVotingTest < Test::Unit::TestCase
       assert_equal 0, @pro.num_sequences
       assert_equal 0, @pro.num_pax
       assert_equal 0, @sample_stream.pax.size
+      assert !@pro.adaptive_sequences
+      assert_equal 0, @pro.max_decision_seconds
+      assert_equal 0, @pro.num_decisions
+    end
+
+    should "stop sampling when the votes are decided" do
+      @pro.num_sequences = 10
+      @pro.num_pax = 1
+      @pro.adaptive_sequences = true
+      @pro.min_sequences = 3
+
+      # after three votes for 1->0, we have 3 < 2*sqrt(3); after four we have
+      # 4 >= 2*sqrt(4), so we stop
+      sample_pax(*([[0, 1, 10]] * 4))
+      put_veh_at 1
+      @sim.run_to 1
+      assert_veh  1,  0,  20
+
+      assert_equal 1, @pro.num_decisions
+      assert_equal 4, @pro.last_num_sequences_used
+      assert_equal 4, @pro.num_sequences_used
+      assert_equal 1, @pro.num_decided_early
+      assert_equal 0, @pro.num_deadline_stops
+      assert_equal 0, @sample_stream.pax.size
+    end
+
+    should "reuse the scenario pool across decisions" do
+      @pro.num_sequences = 1
+      @pro.num_pax = 1
+      @pro.use_scenario_pool = true
+
+      # both vehicles become idle at time 0; the first decision generates the
+      # pool and sends a vehicle to 0; the second reuses it, and the request
+      # is now served by the vehicle on its way to 0
+      sample_pax [0, 1, 10]
+      put_veh_at 1, 1
+      @sim.run_to 1
+      assert_veh  1,  0,  20, 0
+      assert_veh  1,  1,   0, 1
+
+      assert_equal 2, @pro.num_decisions
+      assert_equal 1, @pro.num_scenario_pool_refreshes
+      assert_equal 0, @sample_stream.pax.size
+    end
+
+    should "regenerate the scenario pool when its shape changes" do
+      @pro.num_sequences = 2
+      @pro.num_pax = 1
+      @pro.use_scenario_pool = true
+
+      sample_pax [0, 1, 10], [0, 1, 10]
+      put_veh_at 1
+      @sim.run_to 1
+      assert_veh  1,  0,  20
+      assert_equal 1, @pro.num_scenario_pool_refreshes
+      assert_equal 0, @sample_stream.pax.size
+
+      # same number of requests in the pool, but it must not be reused; the
+      # vehicle becomes idle at 0 at time 20, which needs a new decision
+      @pro.num_sequences = 1
+      @pro.num_pax = 2
+      sample_pax [0, 1, 10], [0, 1, 20]
+      @sim.run_to 21
+      assert_equal 2, @pro.num_decisions
+      assert_equal 2, @pro.num_scenario_pool_refreshes
+      assert_equal 0, @sample_stream.pax.size
     end
 
     should "handle tidal flow" do
@@ -322,5 +388,34 @@ class SamplingVotingTest < Test::Unit::TestCase
     @sim.handle_pax_stream 100, stream
     assert_equal 100, @sim_stats.pax_wait.map(&:to_a).flatten.inject(:+)
   end
+
+  should "give the same results for any number of threads above one" do
+    waits = [2, 4].map do |num_threads|
+      setup_sim TRIP_TIMES_3ST_RING_10_20_30
+      @sim.reactive = BWNNHandler.new(@sim)
+
+      SiTaxi.seed_rng(666)
+      sample_stream = BWPoissonPaxStream.new(0,
+        [[  0, 0.2, 0.4],
+         [0.1,   0, 0.3],
+         [  0, 0.1,   0]])
+      pro = BWSamplingVotingHandler.new(@sim, sample_stream)
+      pro.num_sequences = 5
+      pro.num_pax = 5
+      pro.num_threads = num_threads
+      @sim.proactive = pro
+      @sim.init
+
+      stream = BWPoissonPaxStream.new(0,
+        [[  0, 0.1, 0.2],
+         [  0,   0, 0.4],
+         [0.2, 0.3,   0]])
+      put_veh_at(*([0,1,2]*5))
+      @sim.handle_pax_stream 100, stream
+      @sim_stats.pax_wait.map(&:to_a)
+    end
+    assert_equal 100, waits[0].flatten.inject(:+)
+    assert_equal waits[0], waits[1]
+  end
 end
 
@@ -280,6 +280,26 @@ class TestSiTaxi < Test::Unit::TestCase
         end
       end
 
+      should "be able to sample with the alias method" do
+        @w = SiTaxi::ODMatrixWrapper.new([[0,1,2],[3,0,4],[5,6,0]],
+                                         SiTaxi::EMPIRICAL_SAMPLER_ALIAS)
+        assert_equal SiTaxi::EMPIRICAL_SAMPLER_ALIAS, @w.sampler_method
+        SiTaxi.seed_rng(456)
+        counts = Hash.new(0)
+        n = 21000
+        n.times do
+          origin, destin, interval = @w.sample
+          assert origin != destin
+          assert interval >= 0
+          counts[[origin, destin]] += 1
+        end
+        3.times do |i|
+          3.times do |j|
+            assert_in_delta @w.trip_prob(i, j), counts[[i, j]] / n.to_f, 0.015
+          end
+        end
+      end
+
       should "compute multinomial probabilities" do
         # from R: dmultinom(x=c(...), prob=c(0,1/3,2/3))
         # only one way to produce zero trips
@@ -455,6 +475,38 @@ class TestSiTaxi < Test::Unit::TestCase
     assert_equal 9, pick_from_pmf(pmf, 1)
   end
 
+  should "pick with the alias method" do
+    s = EmpiricalSampler.from_pmf([0.0,0.5,0.0,0.5], 1e-5,
+                                  EMPIRICAL_SAMPLER_ALIAS)
+    assert_equal EMPIRICAL_SAMPLER_ALIAS, s.method
+    assert_equal 1, s.pick_alias(0)
+    assert_equal 1, s.pick_alias(0.25)
+    assert_equal 3, s.pick_alias(0.75)
+    assert_equal 3, s.pick_alias(0.99)
+
+    # the first slot is 0 for 0.4 of its width and 1 for the rest
+    s = EmpiricalSampler.from_pmf([0.2,0.8], 1e-5, EMPIRICAL_SAMPLER_ALIAS)
+    assert_equal 0, s.pick_alias(0.1)
+    assert_equal 1, s.pick_alias(0.3)
+    assert_equal 1, s.pick_alias(0.9)
+  end
+
+  should "sample the same distribution with binary search and alias method" do
+    pmf = [0.1, 0, 0.2, 0.3, 0, 0.4]
+    n = 20000
+    SiTaxi.seed_rng(789)
+    [EMPIRICAL_SAMPLER_BINARY_SEARCH, EMPIRICAL_SAMPLER_ALIAS].each do |method|
+      s = EmpiricalSampler.from_pmf(pmf, 1e-5, method)
+      counts = [0]*pmf.size
+      n.times do counts[s.sample] += 1 end
+      pmf.each_with_index do |p, i|
+        # sd of each frequency is at most sqrt(0.25/n) = 0.0035
+        assert_in_delta p, counts[i] / n.to_f, 0.015
+        assert_equal 0, counts[i] if p == 0
+      end
+    end
+  end
+
   should "list integer partitions" do
     assert_equal [[0]], integer_partitions(0, 1)
     assert_equal [[1]], integer_partitions(1, 1)